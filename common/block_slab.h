@@ -0,0 +1,221 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <mutex>
+#include <new>
+#include <vector>
+
+// Size-class allocator for small, short-lived objects such as control blocks.
+//
+// Sizes are rounded up to a multiple of 16 bytes, up to 256; anything bigger goes straight to
+// the source. Every thread keeps a free list per size class and serves it without locks. An empty
+// list is refilled with a whole magazine of blocks: one that another thread gave back to the
+// shared depot, or a freshly carved 64 KiB slab. A list that grows too long hands a magazine
+// back to the depot. Memory is never returned to the source.
+//
+// Memory comes from Source: AllocateSlab() for a kSlabBytes slab, AllocateLarge(size) and
+// DeallocateLarge(ptr, size) for blocks bigger than kMaxSize and for threads that are exiting.
+// BlockSlab takes it from operator new.
+template <typename Source>
+class BasicBlockSlab {
+public:
+    static constexpr size_t kGranularity = 16;
+    static constexpr size_t kMaxSize = 256;
+    static constexpr size_t kNumClasses = kMaxSize / kGranularity;
+    static constexpr size_t kMagazineSize = 64;
+    static constexpr size_t kSlabBytes = 64 * 1024;
+
+    static void* Allocate(size_t size) {
+        if (size > kMaxSize) {
+            return Source::AllocateLarge(size);
+        }
+        size_t cls = ClassOf(size);
+        ThreadCache* cache = ThreadCache::Local();
+        if (cache == nullptr) {  // The thread is exiting.
+            return Source::AllocateLarge(ClassSize(cls));
+        }
+        FreeList& list = cache->lists[cls];
+        if (list.head == nullptr) {
+            Refill(cls, list);
+        }
+        return list.Pop();
+    }
+
+    static void Deallocate(void* ptr, size_t size) {
+        if (size > kMaxSize) {
+            Source::DeallocateLarge(ptr, size);
+            return;
+        }
+        size_t cls = ClassOf(size);
+        ThreadCache* cache = ThreadCache::Local();
+        if (cache == nullptr) {
+            Depot& depot = Depots()[cls];
+            std::lock_guard lock(depot.mutex);
+            depot.loose.Push(ptr);
+            return;
+        }
+        FreeList& list = cache->lists[cls];
+        list.Push(ptr);
+        if (list.count > list.keep + 2 * kMagazineSize) {
+            Depot& depot = Depots()[cls];
+            FreeList magazine = list.Split(kMagazineSize);
+            std::lock_guard lock(depot.mutex);
+            depot.magazines.push_back(magazine);
+        }
+    }
+
+    // Fills the calling thread's list for blocks of this size up to n and keeps it there, so
+    // the next n allocations of that size take no lock and no malloc.
+    static void Reserve(size_t size, size_t n) {
+        if (size > kMaxSize) {
+            return;
+        }
+        size_t cls = ClassOf(size);
+        ThreadCache* cache = ThreadCache::Local();
+        if (cache == nullptr) {
+            return;
+        }
+        FreeList& list = cache->lists[cls];
+        list.keep = std::max(list.keep, n);
+        while (list.count < n) {
+            Refill(cls, list);
+        }
+    }
+
+private:
+    struct FreeBlock {
+        FreeBlock* next;
+    };
+
+    struct FreeList {
+        void Push(void* ptr) {
+            auto block = static_cast<FreeBlock*>(ptr);
+            block->next = head;
+            head = block;
+            ++count;
+        }
+
+        void* Pop() {
+            FreeBlock* block = head;
+            head = block->next;
+            --count;
+            return block;
+        }
+
+        // Moves the first n blocks into a list of their own.
+        FreeList Split(size_t n) {
+            FreeList front;
+            front.head = head;
+            front.count = n;
+            FreeBlock* last = head;
+            for (size_t i = 1; i < n; ++i) {
+                last = last->next;
+            }
+            head = last->next;
+            last->next = nullptr;
+            count -= n;
+            return front;
+        }
+
+        void Append(FreeList other) {
+            while (other.head != nullptr) {
+                Push(other.Pop());
+            }
+        }
+
+        FreeBlock* head = nullptr;
+        size_t count = 0;
+        size_t keep = 0;
+    };
+
+    struct Depot {
+        std::mutex mutex;
+        std::vector<FreeList> magazines;
+        FreeList loose;
+        std::vector<void*> slabs;
+    };
+
+    struct ThreadCache {
+        enum State { kUnused, kAlive, kDestroyed };
+
+        explicit ThreadCache(State* state) : state(state) {
+            *state = kAlive;
+        }
+
+        ~ThreadCache() {
+            for (size_t cls = 0; cls < kNumClasses; ++cls) {
+                if (lists[cls].head != nullptr) {
+                    Depot& depot = Depots()[cls];
+                    std::lock_guard lock(depot.mutex);
+                    depot.magazines.push_back(lists[cls]);
+                }
+            }
+            *state = kDestroyed;
+        }
+
+        // Null once the cache is gone: blocks may still be freed from later thread_local
+        // destructors.
+        static ThreadCache* Local() {
+            thread_local State state = kUnused;
+            if (state == kDestroyed) {
+                return nullptr;
+            }
+            thread_local ThreadCache cache(&state);
+            return &cache;
+        }
+
+        FreeList lists[kNumClasses];
+        State* state;
+    };
+
+    static size_t ClassOf(size_t size) {
+        return size == 0 ? 0 : (size - 1) / kGranularity;
+    }
+
+    static size_t ClassSize(size_t cls) {
+        return (cls + 1) * kGranularity;
+    }
+
+    static Depot* Depots() {
+        static Depot* depots = new Depot[kNumClasses];  // Outlives every thread.
+        return depots;
+    }
+
+    static void Refill(size_t cls, FreeList& list) {
+        Depot& depot = Depots()[cls];
+        std::lock_guard lock(depot.mutex);
+        if (!depot.magazines.empty()) {
+            list.Append(depot.magazines.back());
+            depot.magazines.pop_back();
+            return;
+        }
+        if (depot.loose.head != nullptr) {
+            list.Append(depot.loose);
+            depot.loose = FreeList();
+            return;
+        }
+        size_t block_size = ClassSize(cls);
+        auto slab = static_cast<char*>(Source::AllocateSlab());
+        depot.slabs.push_back(slab);
+        for (size_t offset = 0; offset + block_size <= kSlabBytes; offset += block_size) {
+            list.Push(slab + offset);
+        }
+    }
+};
+
+struct HeapSlabSource {
+    static void* AllocateSlab() {
+        return ::operator new(BasicBlockSlab<HeapSlabSource>::kSlabBytes);
+    }
+
+    static void* AllocateLarge(size_t size) {
+        return ::operator new(size);
+    }
+
+    static void DeallocateLarge(void* ptr, size_t) {
+        ::operator delete(ptr);
+    }
+};
+
+using BlockSlab = BasicBlockSlab<HeapSlabSource>;
@@ -0,0 +1,8 @@
+#pragma once
+
+#include <cstddef>
+
+// What two cores writing to nearby data must be kept apart by. std::hardware_destructive_
+// interference_size is not available everywhere and changes with compiler flags, so it is
+// fixed here: 64 bytes on x86-64 and most AArch64 cores.
+inline constexpr size_t kCacheLineSize = 64;
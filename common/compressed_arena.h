@@ -0,0 +1,137 @@
+#pragma once
+
+#include "block_slab.h"
+
+#include <sys/mman.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <new>
+#include <unordered_map>
+#include <vector>
+
+// A dedicated heap region whose blocks are named by 32-bit offsets instead of pointers, as in
+// the pointer compression of JS engines. The region is one contiguous reservation of
+// kReserveBytes of address space, committed in kCommitBytes steps as it fills, and an offset
+// counts kAlignment-byte units from its start, so 2^32 units cover all of it. Decoding is a
+// shift and an add to a base that never changes once the region exists.
+//
+// Small blocks are served by a BasicBlockSlab carving slabs out of the region; larger ones are
+// cut from it directly and reused for blocks of the same size. Memory is never unmapped.
+// Offset 0 is never handed out and stands for null.
+class CompressedArena {
+public:
+    static constexpr size_t kAlignment = 16;
+    static constexpr size_t kReserveBytes = size_t(1) << 36;
+    static constexpr size_t kCommitBytes = size_t(1) << 20;
+
+    static_assert(kReserveBytes / kAlignment <= (size_t(1) << 32));
+
+    static void* Allocate(size_t size) {
+        return Slab::Allocate(size);
+    }
+
+    static void Deallocate(void* ptr, size_t size) {
+        Slab::Deallocate(ptr, size);
+    }
+
+    static uint32_t Encode(const void* ptr) {
+        if (ptr == nullptr) {
+            return 0;
+        }
+        return static_cast<uint32_t>((static_cast<const char*>(ptr) - base_) / kAlignment);
+    }
+
+    // Only for offsets returned by Encode of a live block, which implies the region exists.
+    static void* Decode(uint32_t offset) {
+        return offset == 0 ? nullptr : base_ + size_t(offset) * kAlignment;
+    }
+
+    static bool Contains(const void* ptr) {
+        auto bytes = static_cast<const char*>(ptr);
+        return base_ != nullptr && bytes >= base_ && bytes < base_ + kReserveBytes;
+    }
+
+private:
+    struct Source {
+        static void* AllocateSlab() {
+            return Region().Carve(Slab::kSlabBytes);
+        }
+
+        static void* AllocateLarge(size_t size) {
+            return Region().TakeLarge(RoundUp(size));
+        }
+
+        static void DeallocateLarge(void* ptr, size_t size) {
+            Region().GiveLarge(ptr, RoundUp(size));
+        }
+    };
+
+    using Slab = BasicBlockSlab<Source>;
+
+    struct State {
+        State() {
+            void* region = mmap(nullptr, kReserveBytes, PROT_NONE,
+                                MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+            if (region == MAP_FAILED) {
+                throw std::bad_alloc();
+            }
+            base_ = static_cast<char*>(region);
+            top = kAlignment;  // Keeps offset 0 free for null.
+        }
+
+        void* Carve(size_t size) {
+            std::lock_guard lock(mutex);
+            if (size > kReserveBytes - top) {
+                throw std::bad_alloc();
+            }
+            size_t end = top + size;
+            if (end > committed) {
+                size_t grow = (end - committed + kCommitBytes - 1) / kCommitBytes * kCommitBytes;
+                if (grow > kReserveBytes - committed ||
+                    mprotect(base_ + committed, grow, PROT_READ | PROT_WRITE) != 0) {
+                    throw std::bad_alloc();
+                }
+                committed += grow;
+            }
+            char* block = base_ + top;
+            top = end;
+            return block;
+        }
+
+        void* TakeLarge(size_t size) {
+            {
+                std::lock_guard lock(mutex);
+                auto it = large.find(size);
+                if (it != large.end() && !it->second.empty()) {
+                    void* block = it->second.back();
+                    it->second.pop_back();
+                    return block;
+                }
+            }
+            return Carve(size);
+        }
+
+        void GiveLarge(void* ptr, size_t size) {
+            std::lock_guard lock(mutex);
+            large[size].push_back(ptr);
+        }
+
+        std::mutex mutex;
+        size_t top = 0;
+        size_t committed = 0;
+        std::unordered_map<size_t, std::vector<void*>> large;  // Freed blocks by size.
+    };
+
+    static State& Region() {
+        static State* state = new State;  // Outlives every thread.
+        return *state;
+    }
+
+    static size_t RoundUp(size_t size) {
+        return (size + kAlignment - 1) / kAlignment * kAlignment;
+    }
+
+    static inline char* base_ = nullptr;
+};
@@ -0,0 +1,148 @@
+#pragma once
+
+#include <atomic>
+#include <thread>
+
+// On-expire callbacks. A control block whose policy derives from ExpiryList keeps an intrusive
+// list of ExpiryHooks, and runs their callbacks once, right after the object is destroyed, on
+// the thread that destroyed it. A container of weak entries embeds a hook in every entry and
+// unlinks the entry from the callback in O(1), instead of polling Expired().
+//
+// A linked hook holds a weak reference, so the block stays valid until the hook is unlinked:
+// explicitly, by destroying the hook, or by linking it again. Once Unlink returns, the callback
+// is not running and will not run. That means Unlink waits for a callback that is running on
+// another thread right now: do not unlink while holding a lock that the callback takes. Calling
+// Unlink from a callback, on any hook of the same block, never waits.
+//
+// The list is guarded by a spinlock in the block, taken only to link, unlink and fire, so hooks
+// of one block may be linked and unlinked from any thread. A single hook belongs to one thread
+// at a time.
+
+class ExpiryList;
+
+class ExpiryHook {
+public:
+    using Callback = void (*)(ExpiryHook* hook);
+
+    explicit ExpiryHook(Callback callback) : callback_(callback) {
+    }
+
+    ExpiryHook(const ExpiryHook&) = delete;
+    ExpiryHook& operator=(const ExpiryHook&) = delete;
+
+    ~ExpiryHook() {
+        Unlink();
+    }
+
+    // Linked to a block, whether the callback has run already or not.
+    bool IsLinked() const {
+        return list_ != nullptr;
+    }
+
+    // Takes the hook off its block and drops its weak reference.
+    void Unlink();
+
+private:
+    friend class ExpiryList;
+
+    Callback callback_;
+    ExpiryList* list_ = nullptr;
+    void* block_ = nullptr;
+    void (*release_)(void* block) = nullptr;
+    ExpiryHook* prev_ = nullptr;
+    ExpiryHook* next_ = nullptr;
+    bool queued_ = false;  // Still waiting for the object to expire.
+};
+
+class ExpiryList {
+public:
+    // Queues an unlinked hook, which takes over a weak reference to block that the caller
+    // already holds, unless the list has fired; then the reference stays with the caller.
+    bool Link(ExpiryHook* hook, void* block, void (*release)(void* block)) {
+        Lock();
+        if (fired_) {
+            Unlock();
+            return false;
+        }
+        hook->list_ = this;
+        hook->block_ = block;
+        hook->release_ = release;
+        hook->prev_ = nullptr;
+        hook->next_ = head_;
+        if (head_ != nullptr) {
+            head_->prev_ = hook;
+        }
+        head_ = hook;
+        hook->queued_ = true;
+        Unlock();
+        return true;
+    }
+
+    // Runs the callbacks of every queued hook. The lock is dropped around each callback, so
+    // callbacks may unlink and destroy hooks.
+    void Fire() {
+        Lock();
+        fired_ = true;
+        firing_thread_ = std::this_thread::get_id();
+        while (ExpiryHook* hook = head_) {
+            Remove(hook);
+            running_.store(hook, std::memory_order_relaxed);
+            ExpiryHook::Callback callback = hook->callback_;
+            Unlock();
+            callback(hook);  // The hook may be gone after this.
+            Lock();
+            running_.store(nullptr, std::memory_order_release);
+        }
+        Unlock();
+    }
+
+private:
+    friend class ExpiryHook;
+
+    void Lock() {
+        while (lock_.test_and_set(std::memory_order_acquire)) {
+            std::this_thread::yield();
+        }
+    }
+
+    void Unlock() {
+        lock_.clear(std::memory_order_release);
+    }
+
+    void Remove(ExpiryHook* hook) {
+        if (hook->prev_ != nullptr) {
+            hook->prev_->next_ = hook->next_;
+        } else {
+            head_ = hook->next_;
+        }
+        if (hook->next_ != nullptr) {
+            hook->next_->prev_ = hook->prev_;
+        }
+        hook->queued_ = false;
+    }
+
+    std::atomic_flag lock_ = ATOMIC_FLAG_INIT;
+    bool fired_ = false;
+    ExpiryHook* head_ = nullptr;
+    std::atomic<ExpiryHook*> running_ = nullptr;
+    std::thread::id firing_thread_;
+};
+
+inline void ExpiryHook::Unlink() {
+    if (list_ == nullptr) {
+        return;
+    }
+    ExpiryList* list = list_;
+    list->Lock();
+    if (queued_) {
+        list->Remove(this);
+    }
+    bool wait = list->running_.load(std::memory_order_relaxed) == this &&
+                list->firing_thread_ != std::this_thread::get_id();
+    list->Unlock();
+    while (wait && list->running_.load(std::memory_order_acquire) == this) {
+        std::this_thread::yield();
+    }
+    list_ = nullptr;
+    release_(block_);
+}
@@ -0,0 +1,125 @@
+#pragma once
+
+#include "block_slab.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <thread>
+
+// Deferred destruction. Instead of running a destructor chain on the thread that dropped the
+// last reference, the object is pushed onto a global lock-free queue and destroyed later by
+// DrainReclaimQueue(), usually from a BackgroundReclaimer thread. Objects that go through the
+// queue must be safe to destroy on another thread, and whatever is still queued at exit is
+// leaked unless somebody drains it.
+
+struct ReclaimNode {
+    ReclaimNode* next = nullptr;
+    void (*reclaim)(void* object) = nullptr;
+    void* object = nullptr;
+    bool owned = false;  // Allocated by Defer, freed by the queue.
+};
+
+class ReclaimQueue {
+public:
+    // Queues a node that lives inside the object itself; it must stay valid until reclaimed.
+    static void Push(ReclaimNode* node) {
+        ReclaimNode* head = Head().load(std::memory_order_relaxed);
+        do {
+            node->next = head;
+        } while (!Head().compare_exchange_weak(head, node, std::memory_order_release,
+                                               std::memory_order_relaxed));
+    }
+
+    // Queues reclaim(object) with a node from the calling thread's slab cache.
+    static void Defer(void (*reclaim)(void*), void* object) {
+        auto node = new (BlockSlab::Allocate(sizeof(ReclaimNode))) ReclaimNode;
+        node->reclaim = reclaim;
+        node->object = object;
+        node->owned = true;
+        Push(node);
+    }
+
+    // Runs everything queued so far, including what those destructors queue in turn, in the
+    // order it was queued. Returns the number of objects reclaimed.
+    static size_t Drain() {
+        size_t reclaimed = 0;
+        while (ReclaimNode* batch = Head().exchange(nullptr, std::memory_order_acquire)) {
+            ReclaimNode* node = nullptr;
+            while (batch != nullptr) {  // The stack holds the newest first.
+                ReclaimNode* next = batch->next;
+                batch->next = node;
+                node = batch;
+                batch = next;
+            }
+            while (node != nullptr) {
+                // The node may live inside the object, so read it out first.
+                ReclaimNode* next = node->next;
+                auto reclaim = node->reclaim;
+                void* object = node->object;
+                if (node->owned) {
+                    BlockSlab::Deallocate(node, sizeof(ReclaimNode));
+                }
+                reclaim(object);
+                node = next;
+                ++reclaimed;
+            }
+        }
+        return reclaimed;
+    }
+
+    static bool Empty() {
+        return Head().load(std::memory_order_relaxed) == nullptr;
+    }
+
+private:
+    static std::atomic<ReclaimNode*>& Head() {
+        static std::atomic<ReclaimNode*> head = nullptr;
+        return head;
+    }
+};
+
+inline size_t DrainReclaimQueue() {
+    return ReclaimQueue::Drain();
+}
+
+// Drains the queue every `period` on a thread of its own, and once more when destroyed.
+// Releasing threads never wake it, so the release path stays a single CAS.
+class BackgroundReclaimer {
+public:
+    explicit BackgroundReclaimer(std::chrono::microseconds period = std::chrono::milliseconds(1))
+        : period_(period), thread_([this] { Run(); }) {
+    }
+
+    BackgroundReclaimer(const BackgroundReclaimer&) = delete;
+    BackgroundReclaimer& operator=(const BackgroundReclaimer&) = delete;
+
+    ~BackgroundReclaimer() {
+        {
+            std::lock_guard lock(mutex_);
+            stop_ = true;
+        }
+        cv_.notify_one();
+        thread_.join();
+        ReclaimQueue::Drain();
+    }
+
+private:
+    void Run() {
+        std::unique_lock lock(mutex_);
+        while (!stop_) {
+            lock.unlock();
+            ReclaimQueue::Drain();
+            lock.lock();
+            cv_.wait_for(lock, period_, [this] { return stop_; });
+        }
+    }
+
+    std::chrono::microseconds period_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    bool stop_ = false;
+    std::thread thread_;
+};
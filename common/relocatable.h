@@ -0,0 +1,12 @@
+#pragma once
+
+#include <type_traits>
+
+// A type is trivially relocatable if moving an object into new storage and destroying the old
+// one is the same as copying its bytes over. Containers may then grow with memcpy instead of
+// moving and destroying elements one by one. Types opt in by specializing the trait.
+template <typename T>
+struct IsTriviallyRelocatable : std::is_trivially_copyable<T> {};
+
+template <typename T>
+inline constexpr bool kIsTriviallyRelocatable = IsTriviallyRelocatable<T>::value;
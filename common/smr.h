@@ -0,0 +1,350 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <mutex>
+#include <vector>
+
+// Safe memory reclamation for lock-free structures: a reader may dereference a pointer it loaded
+// from a shared slot even if a writer unlinks it at the same moment, because the writer retires
+// the pointer instead of freeing it, and the domain runs the reclaim function only once no reader
+// can still hold it. Two domains share the same interface:
+//
+//     Domain::Guard guard;                      // protects what it loads until destroyed
+//     T* ptr = guard.Protect(atomic_slot);
+//     Domain::Retire(ptr, reclaim);             // after unlinking ptr from every slot
+//     Domain::Collect();                        // reclaims what is already safe
+//
+// HazardPointers publishes every protected pointer, so a retired object waits only for the
+// readers of that object and memory stays bounded, but every Protect is a store plus a full
+// fence. Epochs only marks the thread as active for the whole guard, which makes reads almost
+// free, but one stalled reader delays every reclamation.
+//
+// Guards must not be used from thread_local destructors. What a thread retired and could not
+// reclaim before exiting is handed over to the next Collect on another thread.
+
+struct Retired {
+    void* object;
+    void (*reclaim)(void*);
+    uint64_t epoch = 0;
+};
+
+// Retired objects left behind by exited threads.
+class RetiredOrphans {
+public:
+    static void Give(std::vector<Retired>* retired) {
+        if (retired->empty()) {
+            return;
+        }
+        Orphans& orphans = Get();
+        std::lock_guard lock(orphans.mutex);
+        orphans.list.insert(orphans.list.end(), retired->begin(), retired->end());
+        retired->clear();
+    }
+
+    static void Adopt(std::vector<Retired>* retired) {
+        Orphans& orphans = Get();
+        std::lock_guard lock(orphans.mutex);
+        retired->insert(retired->end(), orphans.list.begin(), orphans.list.end());
+        orphans.list.clear();
+    }
+
+private:
+    struct Orphans {
+        std::mutex mutex;
+        std::vector<Retired> list;
+    };
+
+    static Orphans& Get() {
+        static Orphans* orphans = new Orphans;  // Outlives every thread.
+        return *orphans;
+    }
+};
+
+class HazardPointers {
+public:
+    static constexpr size_t kSlotsPerThread = 4;
+
+    class Guard {
+    public:
+        Guard() : slot_(Local().Acquire()) {
+        }
+
+        Guard(const Guard&) = delete;
+        Guard& operator=(const Guard&) = delete;
+
+        ~Guard() {
+            slot_->store(nullptr, std::memory_order_release);
+            Local().Release();
+        }
+
+        template <typename T>
+        T* Protect(const std::atomic<T*>& src) {
+            T* ptr = src.load(std::memory_order_relaxed);
+            while (true) {
+                slot_->store(ptr, std::memory_order_seq_cst);
+                // Still there after the hazard became visible: no scan can miss it now.
+                T* again = src.load(std::memory_order_seq_cst);
+                if (again == ptr) {
+                    return ptr;
+                }
+                ptr = again;
+            }
+        }
+
+    private:
+        std::atomic<const void*>* slot_;
+    };
+
+    static void Retire(void* object, void (*reclaim)(void*)) {
+        ThreadState& local = Local();
+        local.retired.push_back({object, reclaim});
+        size_t size = local.retired.size();
+        if (size >= kScanThreshold && size >= kScanThreshold + kSlotsPerThread * NumRecords()) {
+            Scan(&local.retired);
+        }
+    }
+
+    static void Collect() {
+        ThreadState& local = Local();
+        RetiredOrphans::Adopt(&local.retired);
+        Scan(&local.retired);
+    }
+
+private:
+    static constexpr size_t kScanThreshold = 64;
+
+    // A thread's hazard slots. Records are never freed, only reused by later threads.
+    struct Record {
+        std::atomic<const void*> slots[kSlotsPerThread] = {};
+        std::atomic<bool> in_use = true;
+        Record* next = nullptr;
+    };
+
+    struct ThreadState {
+        ThreadState() : record(AcquireRecord()) {
+        }
+
+        ~ThreadState() {
+            Scan(&retired);
+            RetiredOrphans::Give(&retired);
+            record->in_use.store(false, std::memory_order_release);
+        }
+
+        std::atomic<const void*>* Acquire() {
+            if (used == kSlotsPerThread) {
+                std::terminate();
+            }
+            return &record->slots[used++];
+        }
+
+        void Release() {
+            --used;
+        }
+
+        Record* record;
+        size_t used = 0;
+        std::vector<Retired> retired;
+    };
+
+    static ThreadState& Local() {
+        thread_local ThreadState state;
+        return state;
+    }
+
+    static std::atomic<Record*>& Records() {
+        static std::atomic<Record*> head = nullptr;
+        return head;
+    }
+
+    static size_t NumRecords() {
+        size_t count = 0;
+        for (Record* rec = Records().load(std::memory_order_acquire); rec; rec = rec->next) {
+            ++count;
+        }
+        return count;
+    }
+
+    static Record* AcquireRecord() {
+        for (Record* rec = Records().load(std::memory_order_acquire); rec; rec = rec->next) {
+            bool free = false;
+            if (rec->in_use.compare_exchange_strong(free, true, std::memory_order_acquire)) {
+                return rec;
+            }
+        }
+        auto rec = new Record;
+        rec->next = Records().load(std::memory_order_relaxed);
+        while (!Records().compare_exchange_weak(rec->next, rec, std::memory_order_release,
+                                                std::memory_order_relaxed)) {
+        }
+        return rec;
+    }
+
+    static void Scan(std::vector<Retired>* retired) {
+        if (retired->empty()) {
+            return;
+        }
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        std::vector<const void*> hazards;
+        for (Record* rec = Records().load(std::memory_order_acquire); rec; rec = rec->next) {
+            for (auto& slot : rec->slots) {
+                if (const void* ptr = slot.load(std::memory_order_acquire)) {
+                    hazards.push_back(ptr);
+                }
+            }
+        }
+        std::sort(hazards.begin(), hazards.end());
+
+        // Reclaiming may retire more objects, so work on a batch of our own.
+        std::vector<Retired> batch;
+        batch.swap(*retired);
+        for (const Retired& entry : batch) {
+            if (std::binary_search(hazards.begin(), hazards.end(), entry.object)) {
+                retired->push_back(entry);
+            } else {
+                entry.reclaim(entry.object);
+            }
+        }
+    }
+};
+
+class Epochs {
+public:
+    class Guard {
+    public:
+        Guard() {
+            Local().Enter();
+        }
+
+        Guard(const Guard&) = delete;
+        Guard& operator=(const Guard&) = delete;
+
+        ~Guard() {
+            Local().Exit();
+        }
+
+        template <typename T>
+        T* Protect(const std::atomic<T*>& src) {
+            return src.load(std::memory_order_acquire);
+        }
+    };
+
+    // Objects are tagged with the epoch they were retired in and reclaimed two epochs later:
+    // by then every reader that was active when they were unlinked has left.
+    static void Retire(void* object, void (*reclaim)(void*)) {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        ThreadState& local = Local();
+        local.retired.push_back({object, reclaim, Global().load(std::memory_order_relaxed)});
+        if (local.retired.size() >= kCollectThreshold) {
+            Collect(&local.retired);
+        }
+    }
+
+    static void Collect() {
+        ThreadState& local = Local();
+        RetiredOrphans::Adopt(&local.retired);
+        Collect(&local.retired);
+    }
+
+private:
+    static constexpr size_t kCollectThreshold = 64;
+    static constexpr uint64_t kIdle = 0;
+
+    struct Record {
+        std::atomic<uint64_t> epoch = kIdle;
+        std::atomic<bool> in_use = true;
+        Record* next = nullptr;
+    };
+
+    struct ThreadState {
+        ThreadState() : record(AcquireRecord()) {
+        }
+
+        ~ThreadState() {
+            Collect(&retired);
+            RetiredOrphans::Give(&retired);
+            record->in_use.store(false, std::memory_order_release);
+        }
+
+        void Enter() {
+            if (depth++ == 0) {
+                record->epoch.store(Global().load(std::memory_order_relaxed),
+                                    std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+            }
+        }
+
+        void Exit() {
+            if (--depth == 0) {
+                record->epoch.store(kIdle, std::memory_order_release);
+            }
+        }
+
+        Record* record;
+        size_t depth = 0;
+        std::vector<Retired> retired;
+    };
+
+    static ThreadState& Local() {
+        thread_local ThreadState state;
+        return state;
+    }
+
+    static std::atomic<uint64_t>& Global() {
+        static std::atomic<uint64_t> epoch = 1;
+        return epoch;
+    }
+
+    static std::atomic<Record*>& Records() {
+        static std::atomic<Record*> head = nullptr;
+        return head;
+    }
+
+    static Record* AcquireRecord() {
+        for (Record* rec = Records().load(std::memory_order_acquire); rec; rec = rec->next) {
+            bool free = false;
+            if (rec->in_use.compare_exchange_strong(free, true, std::memory_order_acquire)) {
+                return rec;
+            }
+        }
+        auto rec = new Record;
+        rec->next = Records().load(std::memory_order_relaxed);
+        while (!Records().compare_exchange_weak(rec->next, rec, std::memory_order_release,
+                                                std::memory_order_relaxed)) {
+        }
+        return rec;
+    }
+
+    // The epoch moves on once every active thread has seen the current one.
+    static void TryAdvance() {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        uint64_t epoch = Global().load(std::memory_order_relaxed);
+        for (Record* rec = Records().load(std::memory_order_acquire); rec; rec = rec->next) {
+            uint64_t seen = rec->epoch.load(std::memory_order_acquire);
+            if (seen != kIdle && seen != epoch) {
+                return;
+            }
+        }
+        Global().compare_exchange_strong(epoch, epoch + 1, std::memory_order_acq_rel);
+    }
+
+    static void Collect(std::vector<Retired>* retired) {
+        if (retired->empty()) {
+            return;
+        }
+        TryAdvance();
+        uint64_t epoch = Global().load(std::memory_order_acquire);
+        std::vector<Retired> batch;
+        batch.swap(*retired);
+        for (const Retired& entry : batch) {
+            if (entry.epoch + 2 <= epoch) {
+                entry.reclaim(entry.object);
+            } else {
+                retired->push_back(entry);
+            }
+        }
+    }
+};
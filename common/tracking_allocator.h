@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdlib>
+
+struct AllocationStats {
+    int allocations = 0;
+    int deallocations = 0;
+};
+
+// A stateful allocator that counts what goes through it. It takes memory from malloc, so
+// allocations_checker sees only what bypasses the allocator.
+template <typename T>
+class TrackingAllocator {
+public:
+    using value_type = T;
+
+    explicit TrackingAllocator(AllocationStats* stats) : stats_(stats) {
+    }
+
+    template <typename U>
+    TrackingAllocator(const TrackingAllocator<U>& other) : stats_(other.stats_) {
+    }
+
+    T* allocate(size_t n) {
+        ++stats_->allocations;
+        return static_cast<T*>(std::malloc(n * sizeof(T)));
+    }
+
+    void deallocate(T* ptr, size_t) {
+        ++stats_->deallocations;
+        std::free(ptr);
+    }
+
+    template <typename U>
+    bool operator==(const TrackingAllocator<U>& other) const {
+        return stats_ == other.stats_;
+    }
+
+private:
+    template <typename U>
+    friend class TrackingAllocator;
+
+    AllocationStats* stats_;
+};
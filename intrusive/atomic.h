@@ -0,0 +1,87 @@
+#pragma once
+
+#include "intrusive.h"
+
+#include <common/smr.h>
+
+#include <atomic>
+
+// AtomicIntrusivePtr<T>: an IntrusivePtr slot that many threads may load and store concurrently.
+//
+// The slot owns one reference to what it points to. A reader protects the pointer through a
+// reclamation domain (common/smr.h) and only then takes its own reference; a writer that swaps
+// the pointer out retires the slot's reference instead of dropping it, so the count cannot reach
+// zero while a reader is between the load and its IncRef. T must count atomically, e.g. derive
+// from AtomicRefCounted.
+//
+// Pointers are compared by address: a node that is stored, removed and stored again looks
+// unchanged to CompareExchange, so lock-free structures should not reuse nodes.
+
+template <typename T, typename Domain = HazardPointers>
+class AtomicIntrusivePtr {
+public:
+    AtomicIntrusivePtr() = default;
+
+    explicit AtomicIntrusivePtr(IntrusivePtr<T> desired) : ptr_(Take(desired)) {
+    }
+
+    AtomicIntrusivePtr(const AtomicIntrusivePtr&) = delete;
+    AtomicIntrusivePtr& operator=(const AtomicIntrusivePtr&) = delete;
+
+    // Nobody may be reading the slot anymore, so its reference is dropped right away.
+    ~AtomicIntrusivePtr() {
+        if (T* ptr = ptr_.load(std::memory_order_acquire)) {
+            ptr->DecRef();
+        }
+    }
+
+    IntrusivePtr<T> Load() const {
+        typename Domain::Guard guard;
+        return IntrusivePtr<T>(guard.Protect(ptr_));
+    }
+
+    void Store(IntrusivePtr<T> desired) {
+        Retire(ptr_.exchange(Take(desired), std::memory_order_acq_rel));
+    }
+
+    IntrusivePtr<T> Exchange(IntrusivePtr<T> desired) {
+        T* old = ptr_.exchange(Take(desired), std::memory_order_acq_rel);
+        IntrusivePtr<T> result(old);
+        Retire(old);
+        return result;
+    }
+
+    // Stores desired if the slot still points to expected. Otherwise loads the current value
+    // into expected and returns false.
+    bool CompareExchange(IntrusivePtr<T>& expected, IntrusivePtr<T> desired) {
+        T* old = expected.Get();
+        if (ptr_.compare_exchange_strong(old, desired.Get(), std::memory_order_acq_rel,
+                                         std::memory_order_relaxed)) {
+            Take(desired);
+            Retire(old);
+            return true;
+        }
+        expected = Load();
+        return false;
+    }
+
+private:
+    // Moves the reference held by ptr into the slot.
+    static T* Take(IntrusivePtr<T>& ptr) {
+        T* raw = ptr.Get();
+        ptr.Set(nullptr);
+        return raw;
+    }
+
+    static void Retire(T* ptr) {
+        if (ptr != nullptr) {
+            Domain::Retire(ptr, &Release);
+        }
+    }
+
+    static void Release(void* ptr) {
+        static_cast<T*>(ptr)->DecRef();
+    }
+
+    std::atomic<T*> ptr_ = nullptr;
+};
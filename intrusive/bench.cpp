@@ -0,0 +1,56 @@
+#include "intrusive.h"
+
+#include <benchmark/benchmark.h>
+
+#include <cstdint>
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// Thread 0 keeps taking and dropping a reference while the other threads only read the object.
+// AtomicRefCounted keeps the counter next to the fields, IsolatedRefCounted on a line of its own.
+// WeakRefCounted is AtomicRefCounted with a CAS loop instead of fetch_add, and no side table.
+
+template <template <typename...> typename Base>
+struct Quote : Base<Quote<Base>> {
+    int64_t bid = 100;
+    int64_t ask = 101;
+};
+
+template <typename Derived>
+using Atomic = AtomicRefCounted<Derived>;
+
+template <typename Derived>
+using Isolated = IsolatedRefCounted<Derived>;
+
+template <typename Derived>
+using Weak = WeakRefCounted<Derived>;
+
+template <template <typename...> typename Base>
+void BM_ReadWhileCounting(benchmark::State& state) {
+    static IntrusivePtr<Quote<Base>> quote = MakeIntrusive<Quote<Base>>();
+    for (auto _ : state) {
+        if (state.thread_index() == 0) {
+            IntrusivePtr<Quote<Base>> copy = quote;
+            benchmark::DoNotOptimize(copy);
+        } else {
+            benchmark::DoNotOptimize(quote->bid + quote->ask);
+        }
+    }
+}
+
+BENCHMARK_TEMPLATE(BM_ReadWhileCounting, Atomic)->ThreadRange(2, 64)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_ReadWhileCounting, Isolated)->ThreadRange(2, 64)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_ReadWhileCounting, Weak)->ThreadRange(2, 64)->UseRealTime();
+
+// One thread taking and dropping references: fetch_add against a CAS loop.
+template <template <typename...> typename Base>
+void BM_CopyRelease(benchmark::State& state) {
+    auto quote = MakeIntrusive<Quote<Base>>();
+    for (auto _ : state) {
+        IntrusivePtr<Quote<Base>> copy = quote;
+        benchmark::DoNotOptimize(copy);
+    }
+}
+
+BENCHMARK_TEMPLATE(BM_CopyRelease, Atomic);
+BENCHMARK_TEMPLATE(BM_CopyRelease, Weak);
@@ -0,0 +1,88 @@
+#include "intrusive.h"
+#include "lock_free.h"
+
+#include <benchmark/benchmark.h>
+
+#include <mutex>
+#include <optional>
+#include <queue>
+#include <stack>
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// Every thread pushes and pops in turn. The baselines guard std::stack / std::queue with a mutex.
+
+template <typename T>
+class MutexStack {
+public:
+    void Push(T value) {
+        std::lock_guard lock(mutex_);
+        stack_.push(std::move(value));
+    }
+
+    std::optional<T> Pop() {
+        std::lock_guard lock(mutex_);
+        if (stack_.empty()) {
+            return std::nullopt;
+        }
+        T value = std::move(stack_.top());
+        stack_.pop();
+        return value;
+    }
+
+private:
+    std::mutex mutex_;
+    std::stack<T> stack_;
+};
+
+template <typename T>
+class MutexQueue {
+public:
+    void Enqueue(T value) {
+        std::lock_guard lock(mutex_);
+        queue_.push(std::move(value));
+    }
+
+    std::optional<T> Dequeue() {
+        std::lock_guard lock(mutex_);
+        if (queue_.empty()) {
+            return std::nullopt;
+        }
+        T value = std::move(queue_.front());
+        queue_.pop();
+        return value;
+    }
+
+private:
+    std::mutex mutex_;
+    std::queue<T> queue_;
+};
+
+template <typename Stack>
+void BM_Stack(benchmark::State& state) {
+    static Stack stack;
+    int value = 0;
+    for (auto _ : state) {
+        stack.Push(++value);
+        benchmark::DoNotOptimize(stack.Pop());
+    }
+}
+
+template <typename Queue>
+void BM_Queue(benchmark::State& state) {
+    static Queue queue;
+    int value = 0;
+    for (auto _ : state) {
+        queue.Enqueue(++value);
+        benchmark::DoNotOptimize(queue.Dequeue());
+    }
+}
+
+BENCHMARK_TEMPLATE(BM_Stack, TreiberStack<int, HazardPointers>)->ThreadRange(1, 16)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_Stack, TreiberStack<int, Epochs>)->ThreadRange(1, 16)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_Stack, MutexStack<int>)->ThreadRange(1, 16)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_Queue, MichaelScottQueue<int, HazardPointers>)
+    ->ThreadRange(1, 16)
+    ->UseRealTime();
+BENCHMARK_TEMPLATE(BM_Queue, MichaelScottQueue<int, Epochs>)->ThreadRange(1, 16)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_Queue, MutexQueue<int>)->ThreadRange(1, 16)->UseRealTime();
@@ -0,0 +1,68 @@
+#include "intrusive.h"
+#include "object_pool.h"
+
+#include <benchmark/benchmark.h>
+
+#include <cstdint>
+#include <vector>
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// Allocate/release churn: one object at a time, and batches of 64 held at once, on every thread.
+// MakeIntrusive goes to the heap every time; the pool recycles the memory of released objects.
+
+struct Order {
+    int64_t id = 0;
+    int64_t price = 0;
+    int64_t quantity = 0;
+};
+
+struct HeapOrder : AtomicRefCounted<HeapOrder>, Order {};
+
+struct PooledOrder : PooledRefCounted<PooledOrder>, Order {};
+
+constexpr int kBatch = 64;
+
+void BM_MakeIntrusive(benchmark::State& state) {
+    for (auto _ : state) {
+        auto order = MakeIntrusive<HeapOrder>();
+        benchmark::DoNotOptimize(order.Get());
+    }
+}
+
+void BM_PoolAllocate(benchmark::State& state) {
+    static IntrusiveObjectPool<PooledOrder> pool;
+    for (auto _ : state) {
+        auto order = pool.Allocate();
+        benchmark::DoNotOptimize(order.Get());
+    }
+}
+
+template <typename Make>
+void Batches(benchmark::State& state, Make make) {
+    std::vector<decltype(make())> orders;
+    orders.reserve(kBatch);
+    for (auto _ : state) {
+        for (int i = 0; i < kBatch; ++i) {
+            orders.push_back(make());
+        }
+        orders.clear();
+    }
+    state.SetItemsProcessed(state.iterations() * kBatch);
+}
+
+void BM_MakeIntrusiveBatch(benchmark::State& state) {
+    Batches(state, [] { return MakeIntrusive<HeapOrder>(); });
+}
+
+void BM_PoolAllocateBatch(benchmark::State& state) {
+    static IntrusiveObjectPool<PooledOrder> pool;
+    Batches(state, [] { return pool.Allocate(); });
+}
+
+BENCHMARK(BM_MakeIntrusive)->ThreadRange(1, 4)->UseRealTime();
+BENCHMARK(BM_PoolAllocate)->ThreadRange(1, 4)->UseRealTime();
+BENCHMARK(BM_MakeIntrusiveBatch)->ThreadRange(1, 4)->UseRealTime();
+BENCHMARK(BM_PoolAllocateBatch)->ThreadRange(1, 4)->UseRealTime();
+
+BENCHMARK_MAIN();
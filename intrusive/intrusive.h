@@ -1,6 +1,14 @@
 #pragma once
 
+#include <common/cache_line.h>
+#include <common/reclaim_queue.h>
+#include <common/relocatable.h>
+#include <unique/compressed_pair.h>
+
+#include <atomic>
 #include <cstddef>  // for std::nullptr_t
+#include <cstdint>
+#include <memory>   // for std::allocator_traits
 #include <utility>  // for std::exchange / std::swap
 
 class SimpleCounter {
@@ -21,6 +29,186 @@ private:
     size_t count_ = 0;
 };
 
+// 4-byte counter. It saturates instead of wrapping around: once it reaches its maximum,
+// it stays there and the object is never deleted (a leak rather than a use-after-free).
+class CompactCounter {
+public:
+    static constexpr uint32_t kSaturated = UINT32_MAX;
+
+    size_t IncRef() {
+        if (count_ != kSaturated) {
+            ++count_;
+        }
+        return count_;
+    };
+    size_t DecRef() {
+        if (count_ != kSaturated) {
+            --count_;
+        }
+        return count_;
+    };
+    size_t RefCount() const {
+        return count_;
+    };
+
+private:
+    uint32_t count_ = 0;
+};
+
+// For objects shared between threads, e.g. through AtomicIntrusivePtr. A copy of an object
+// starts with a count of its own.
+class AtomicCounter {
+public:
+    AtomicCounter() = default;
+    AtomicCounter(const AtomicCounter&) {
+    }
+    AtomicCounter& operator=(const AtomicCounter&) {
+        return *this;
+    }
+
+    size_t IncRef() {
+        return count_.fetch_add(1, std::memory_order_relaxed) + 1;
+    };
+    size_t DecRef() {
+        return count_.fetch_sub(1, std::memory_order_acq_rel) - 1;
+    };
+    size_t RefCount() const {
+        return count_.load(std::memory_order_acquire);
+    };
+
+private:
+    std::atomic<size_t> count_ = 0;
+};
+
+// Puts a counter on a cache line of its own. Fields of the derived type start on the next
+// line, so count updates by one core do not evict them from the caches of the readers.
+template <typename Counter>
+class alignas(kCacheLineSize) IsolatedCounter : public Counter {};
+
+// Where the counts of an object live once it has been weakly referenced. The object holds one
+// weak reference to its table, so the table outlives both the object and every IntrusiveWeakPtr.
+class WeakSideTable {
+public:
+    explicit WeakSideTable(size_t strong) : strong_(strong) {
+    }
+
+    size_t StrongCount() const {
+        return strong_.load(std::memory_order_acquire);
+    }
+
+    // Fails once the object is expired.
+    bool TryStrongIncrement() {
+        size_t count = strong_.load(std::memory_order_relaxed);
+        while (count != 0) {
+            if (strong_.compare_exchange_weak(count, count + 1, std::memory_order_acquire,
+                                              std::memory_order_relaxed)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void WeakIncrement() {
+        weak_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void WeakDecrement() {
+        if (weak_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            delete this;
+        }
+    }
+
+private:
+    friend class WeakCounter;
+
+    std::atomic<size_t> strong_;
+    std::atomic<size_t> weak_ = 1;
+};
+
+// An atomic counter that also supports IntrusiveWeakPtr, as Swift objects do. The one word holds
+// the strong count until the object is first weakly referenced; then the counts move to a
+// WeakSideTable allocated on the spot, and the word holds a tagged pointer to it. Objects that
+// are never weakly referenced take one word and no allocation, like with AtomicCounter, but
+// every count is a CAS loop rather than a fetch_add, since the word may turn into a pointer at
+// any moment (BM_CopyRelease in bench_intrusive). Once the table exists, every count goes
+// through one more indirection.
+class WeakCounter {
+public:
+    WeakCounter() = default;
+    WeakCounter(const WeakCounter&) {
+    }
+    WeakCounter& operator=(const WeakCounter&) {
+        return *this;
+    }
+
+    ~WeakCounter() {
+        uintptr_t bits = bits_.load(std::memory_order_acquire);
+        if (bits & kTableBit) {
+            ToTable(bits)->WeakDecrement();
+        }
+    }
+
+    // Loads are acquire: a tagged word must come with the table it points to.
+    size_t IncRef() {
+        uintptr_t bits = bits_.load(std::memory_order_acquire);
+        while (!(bits & kTableBit)) {
+            if (bits_.compare_exchange_weak(bits, bits + kOne, std::memory_order_acquire)) {
+                return (bits >> 1) + 1;
+            }
+        }
+        return ToTable(bits)->strong_.fetch_add(1, std::memory_order_relaxed) + 1;
+    }
+
+    size_t DecRef() {
+        uintptr_t bits = bits_.load(std::memory_order_acquire);
+        while (!(bits & kTableBit)) {
+            if (bits_.compare_exchange_weak(bits, bits - kOne, std::memory_order_acq_rel,
+                                            std::memory_order_acquire)) {
+                return (bits >> 1) - 1;
+            }
+        }
+        return ToTable(bits)->strong_.fetch_sub(1, std::memory_order_acq_rel) - 1;
+    }
+
+    size_t RefCount() const {
+        uintptr_t bits = bits_.load(std::memory_order_acquire);
+        if (bits & kTableBit) {
+            return ToTable(bits)->StrongCount();
+        }
+        return bits >> 1;
+    }
+
+    // Allocates the table the first time. The caller holds a strong reference.
+    WeakSideTable* SideTable() {
+        uintptr_t bits = bits_.load(std::memory_order_acquire);
+        if (bits & kTableBit) {
+            return ToTable(bits);
+        }
+        auto table = new WeakSideTable(bits >> 1);
+        auto tagged = reinterpret_cast<uintptr_t>(table) | kTableBit;
+        // The count may change under us; the table takes whatever it was when we won.
+        while (!bits_.compare_exchange_weak(bits, tagged, std::memory_order_acq_rel,
+                                            std::memory_order_acquire)) {
+            if (bits & kTableBit) {
+                delete table;
+                return ToTable(bits);
+            }
+            table->strong_.store(bits >> 1, std::memory_order_relaxed);
+        }
+        return table;
+    }
+
+private:
+    static constexpr uintptr_t kTableBit = 1;
+    static constexpr uintptr_t kOne = 2;
+
+    static WeakSideTable* ToTable(uintptr_t bits) {
+        return reinterpret_cast<WeakSideTable*>(bits & ~kTableBit);
+    }
+
+    std::atomic<uintptr_t> bits_ = 0;
+};
+
 struct DefaultDelete {
     template <typename T>
     auto operator()(T* object) {
@@ -28,31 +216,143 @@ struct DefaultDelete {
     }
 };
 
+// RefCounted<T, Counter, DeferredDelete<>>: the last DecRef queues the object and
+// DrainReclaimQueue() runs D on it later.
+template <typename D = DefaultDelete>
+struct DeferredDelete {
+    template <typename T>
+    void operator()(T* object) {
+        ReclaimQueue::Defer(&Reclaim<T>, object);
+    }
+
+    template <typename T>
+    static void Reclaim(void* object) {
+        D deleter;
+        deleter(static_cast<T*>(object));
+    }
+};
+
+// An object created by AllocateIntrusive together with its allocator. The object comes first,
+// so a pointer to it is also a pointer to the block.
+template <typename T, typename Alloc>
+struct AllocatedBlock {
+    using ObjTraits = typename std::allocator_traits<Alloc>::template rebind_traits<T>;
+    using BlockAlloc = typename std::allocator_traits<Alloc>::template rebind_alloc<AllocatedBlock>;
+
+    explicit AllocatedBlock(const Alloc& alloc) : cp(RawStorage<T>(), Alloc(alloc)) {
+    }
+
+    // The storage is the first member of the pair, and the pair of the block: in a
+    // standard-layout class that puts the object at the address of the block. AllocateIntrusive
+    // checks the same.
+    static AllocatedBlock* FromObject(T* object) {
+        static_assert(std::is_standard_layout_v<AllocatedBlock>,
+                      "AllocateIntrusive needs a standard-layout allocator");
+        return reinterpret_cast<AllocatedBlock*>(object);
+    }
+
+    CompressedPair<RawStorage<T>, Alloc> cp;
+};
+
+// Deleter for types created with AllocateIntrusive<T, Alloc>: RefCounted<T, Counter,
+// AllocatorDelete<Alloc>>. It must see the type that was allocated, not a base of it. Objects
+// of such types must come from AllocateIntrusive only: MakeIntrusive refuses them, but an
+// IntrusivePtr made from a plain new is freed as if it were a block.
+template <typename Alloc>
+struct AllocatorDelete {
+    template <typename T>
+    void operator()(T* object) {
+        using Block = AllocatedBlock<T, Alloc>;
+        Block* block = Block::FromObject(object);
+        typename Block::ObjTraits::allocator_type obj_alloc(block->cp.GetSecond());
+        typename Block::BlockAlloc block_alloc(block->cp.GetSecond());
+        Block::ObjTraits::destroy(obj_alloc, object);
+        block->~Block();
+        std::allocator_traits<typename Block::BlockAlloc>::deallocate(block_alloc, block, 1);
+    }
+};
+
+// The allocator T is freed with: Alloc when its deleter is AllocatorDelete<Alloc>, else void.
+template <typename T, typename = void>
+struct DeleterAllocator {
+    using Type = void;
+};
+
+template <typename T>
+struct DeleterAllocator<T, std::void_t<decltype(std::declval<T&>().GetDeleter())>>
+    : DeleterAllocator<std::decay_t<decltype(std::declval<T&>().GetDeleter())>> {};
+
+template <typename Alloc>
+struct DeleterAllocator<AllocatorDelete<Alloc>> {
+    using Type = Alloc;
+};
+
+// Whether T is freed by some AllocatorDelete<Alloc>.
+template <typename T>
+using UsesAllocatorDelete = std::negation<std::is_void<typename DeleterAllocator<T>::Type>>;
+
+// Whether T is freed by AllocatorDelete with an allocator that rebinds to the same one as Alloc,
+// so AllocateIntrusive<T>(Alloc) makes objects its deleter can free.
+template <typename T, typename Alloc, typename A = typename DeleterAllocator<T>::Type>
+struct FreedByAllocator
+    : std::is_same<typename std::allocator_traits<A>::template rebind_alloc<T>,
+                   typename std::allocator_traits<Alloc>::template rebind_alloc<T>> {};
+
+template <typename T, typename Alloc>
+struct FreedByAllocator<T, Alloc, void> : std::false_type {};
+
+// The deleter lives next to the counter, so it may carry state, e.g. the pool the object goes
+// back to (ReturnToPool). Empty deleters take no space. The last DecRef calls the object's own
+// deleter in place, and the deleter may destroy the object it is part of.
 template <typename Derived, typename Counter, typename Deleter>
 class RefCounted {
 public:
     void IncRef() {
-        counter_.IncRef();
+        cp_.GetFirst().IncRef();
     }
 
     void DecRef() {
-        if (counter_.RefCount() == 0 || counter_.DecRef() == 0) {
-            Deleter deleter;
-            deleter(static_cast<Derived*>(this));
+        if (cp_.GetFirst().RefCount() == 0 || cp_.GetFirst().DecRef() == 0) {
+            cp_.GetSecond()(static_cast<Derived*>(this));
         }
     }
 
     size_t RefCount() const {
-        return counter_.RefCount();
+        return cp_.GetFirst().RefCount();
     };
 
+    Deleter& GetDeleter() {
+        return cp_.GetSecond();
+    }
+
+    const Deleter& GetDeleter() const {
+        return cp_.GetSecond();
+    }
+
+    // For IntrusiveWeakPtr; only counters like WeakCounter have one.
+    WeakSideTable* GetSideTable() {
+        return cp_.GetFirst().SideTable();
+    }
+
 private:
-    Counter counter_;
+    CompressedPair<Counter, Deleter> cp_;
 };
 
 template <typename Derived, typename D = DefaultDelete>
 using SimpleRefCounted = RefCounted<Derived, SimpleCounter, D>;
 
+template <typename Derived, typename D = DefaultDelete>
+using CompactRefCounted = RefCounted<Derived, CompactCounter, D>;
+
+template <typename Derived, typename D = DefaultDelete>
+using AtomicRefCounted = RefCounted<Derived, AtomicCounter, D>;
+
+template <typename Derived, typename D = DefaultDelete>
+using IsolatedRefCounted = RefCounted<Derived, IsolatedCounter<AtomicCounter>, D>;
+
+template <typename Derived, typename D = DefaultDelete>
+using WeakRefCounted = RefCounted<Derived, WeakCounter, D>;
+
 template <typename T>
 class IntrusivePtr {
 public:
@@ -70,21 +370,13 @@ public:
     };
 
     template <typename Y>
-    IntrusivePtr(IntrusivePtr<Y>&& other) {
-        ptr_ = other.ptr_;
-        SafeIncrement();
-        other.Reset();
-    };
+    IntrusivePtr(IntrusivePtr<Y>&& other) noexcept : ptr_(std::exchange(other.ptr_, nullptr)){};
 
     IntrusivePtr(const IntrusivePtr& other) {
         ptr_ = other.ptr_;
         SafeIncrement();
     };
-    IntrusivePtr(IntrusivePtr&& other) {
-        ptr_ = other.ptr_;
-        SafeIncrement();
-        other.Reset();
-    };
+    IntrusivePtr(IntrusivePtr&& other) noexcept : ptr_(std::exchange(other.ptr_, nullptr)){};
 
     // `operator=`-s
 
@@ -98,14 +390,8 @@ public:
         return *this;
     };
 
-    IntrusivePtr& operator=(IntrusivePtr&& other) {
-        if (this == &other) {
-            return *this;
-        }
-        SafeDecrement();
-        ptr_ = other.ptr_;
-        SafeIncrement();
-        other.Reset();
+    IntrusivePtr& operator=(IntrusivePtr&& other) noexcept {
+        IntrusivePtr(std::move(other)).Swap(*this);
         return *this;
     };
 
@@ -158,8 +444,8 @@ public:
         ptr_ = ptr;
         SafeIncrement();
     };
-    void Swap(IntrusivePtr& other) {
-        std::swap(*this, other);
+    void Swap(IntrusivePtr& other) noexcept {
+        std::swap(ptr_, other.ptr_);
     };
 
     T* Get() const {
@@ -192,11 +478,113 @@ private:
     T* ptr_;
 };
 
+template <typename T>
+struct IsTriviallyRelocatable<IntrusivePtr<T>> : std::true_type {};
+
+// A weak reference to an object counted by WeakCounter (WeakRefCounted). It points to the
+// object and to its side table: the table says whether the object is still there.
+template <typename T>
+class IntrusiveWeakPtr {
+public:
+    IntrusiveWeakPtr() = default;
+
+    IntrusiveWeakPtr(const IntrusivePtr<T>& other) : ptr_(other.Get()) {
+        if (ptr_ != nullptr) {
+            table_ = ptr_->GetSideTable();
+            table_->WeakIncrement();
+        }
+    }
+
+    IntrusiveWeakPtr(const IntrusiveWeakPtr& other) : ptr_(other.ptr_), table_(other.table_) {
+        if (table_ != nullptr) {
+            table_->WeakIncrement();
+        }
+    }
+
+    IntrusiveWeakPtr(IntrusiveWeakPtr&& other) noexcept
+        : ptr_(std::exchange(other.ptr_, nullptr)), table_(std::exchange(other.table_, nullptr)) {
+    }
+
+    IntrusiveWeakPtr& operator=(const IntrusiveWeakPtr& other) {
+        IntrusiveWeakPtr(other).Swap(*this);
+        return *this;
+    }
+
+    IntrusiveWeakPtr& operator=(IntrusiveWeakPtr&& other) noexcept {
+        IntrusiveWeakPtr(std::move(other)).Swap(*this);
+        return *this;
+    }
+
+    ~IntrusiveWeakPtr() {
+        if (table_ != nullptr) {
+            table_->WeakDecrement();
+        }
+    }
+
+    void Reset() {
+        IntrusiveWeakPtr().Swap(*this);
+    }
+
+    void Swap(IntrusiveWeakPtr& other) noexcept {
+        std::swap(ptr_, other.ptr_);
+        std::swap(table_, other.table_);
+    }
+
+    size_t UseCount() const {
+        return table_ == nullptr ? 0 : table_->StrongCount();
+    }
+
+    bool Expired() const {
+        return UseCount() == 0;
+    }
+
+    IntrusivePtr<T> Lock() const {
+        IntrusivePtr<T> result;
+        if (table_ != nullptr && table_->TryStrongIncrement()) {
+            result.Set(ptr_);  // Already counted.
+        }
+        return result;
+    }
+
+private:
+    T* ptr_ = nullptr;
+    WeakSideTable* table_ = nullptr;
+};
+
+template <typename T>
+struct IsTriviallyRelocatable<IntrusiveWeakPtr<T>> : std::true_type {};
+
 template <typename T, typename... Args>
 IntrusivePtr<T> MakeIntrusive(Args&&... args) {
+    static_assert(!UsesAllocatorDelete<T>::value,
+                  "T is freed by AllocatorDelete, create it with AllocateIntrusive");
     IntrusivePtr<T> ip;
     T* obj = new T(std::forward<Args>(args)...);
     ip.Set(obj);
     ip.SafeIncrement();
     return ip;
 };
+
+template <typename T, typename Alloc, typename... Args>
+IntrusivePtr<T> AllocateIntrusive(const Alloc& alloc, Args&&... args) {
+    static_assert(FreedByAllocator<T, Alloc>::value,
+                  "T must be freed by AllocatorDelete with this allocator, rebound or not");
+    // The block AllocatorDelete<A> frees is AllocatedBlock<T, A>, whatever Alloc was given.
+    using Block = AllocatedBlock<T, typename DeleterAllocator<T>::Type>;
+    using BlockTraits = std::allocator_traits<typename Block::BlockAlloc>;
+    typename Block::BlockAlloc block_alloc(alloc);
+    Block* block = BlockTraits::allocate(block_alloc, 1);
+    new (block) Block(alloc);
+    T* obj = block->cp.GetFirst().Get();
+    static_assert(std::is_standard_layout_v<Block>,
+                  "AllocateIntrusive needs a standard-layout allocator");
+    try {
+        typename Block::ObjTraits::allocator_type obj_alloc(alloc);
+        Block::ObjTraits::construct(obj_alloc, obj, std::forward<Args>(args)...);
+    } catch (...) {
+        block->~Block();
+        BlockTraits::deallocate(block_alloc, block, 1);
+        throw;
+    }
+    return IntrusivePtr<T>(obj);
+};
@@ -0,0 +1,120 @@
+#pragma once
+
+#include "atomic.h"
+#include "intrusive.h"
+
+#include <optional>
+#include <utility>
+
+// Lock-free containers built on AtomicIntrusivePtr, as examples of using it with either
+// reclamation domain. Nodes are reference counted: a thread that loaded a node keeps it alive,
+// and a node is never pushed twice, so comparing addresses is safe.
+
+// Treiber stack: a singly linked list with a CAS on the head.
+template <typename T, typename Domain = HazardPointers>
+class TreiberStack {
+public:
+    TreiberStack() = default;
+
+    TreiberStack(const TreiberStack&) = delete;
+    TreiberStack& operator=(const TreiberStack&) = delete;
+
+    // Pops one by one, a recursive destruction of a long list could overflow the stack.
+    ~TreiberStack() {
+        while (Pop()) {
+        }
+    }
+
+    void Push(T value) {
+        auto node = MakeIntrusive<Node>(std::move(value));
+        node->next = head_.Load();
+        while (!head_.CompareExchange(node->next, node)) {
+        }
+    }
+
+    std::optional<T> Pop() {
+        IntrusivePtr<Node> top = head_.Load();
+        // next is never changed once the node is published.
+        while (top && !head_.CompareExchange(top, top->next)) {
+        }
+        if (!top) {
+            return std::nullopt;
+        }
+        return top->value;
+    }
+
+private:
+    struct Node : AtomicRefCounted<Node> {
+        explicit Node(T value) : value(std::move(value)) {
+        }
+
+        const T value;
+        IntrusivePtr<Node> next;
+    };
+
+    AtomicIntrusivePtr<Node, Domain> head_;
+};
+
+// Michael-Scott queue: a linked list with a dummy node at the head. Enqueue links a node after
+// the tail and then swings the tail; any thread that finds the tail lagging moves it on.
+template <typename T, typename Domain = HazardPointers>
+class MichaelScottQueue {
+public:
+    MichaelScottQueue() {
+        auto dummy = MakeIntrusive<Node>();
+        head_.Store(dummy);
+        tail_.Store(dummy);
+    }
+
+    MichaelScottQueue(const MichaelScottQueue&) = delete;
+    MichaelScottQueue& operator=(const MichaelScottQueue&) = delete;
+
+    ~MichaelScottQueue() {
+        while (Dequeue()) {
+        }
+    }
+
+    void Enqueue(T value) {
+        auto node = MakeIntrusive<Node>(std::move(value));
+        while (true) {
+            IntrusivePtr<Node> tail = tail_.Load();
+            IntrusivePtr<Node> next = tail->next.Load();
+            if (next) {
+                tail_.CompareExchange(tail, next);
+            } else if (tail->next.CompareExchange(next, node)) {
+                tail_.CompareExchange(tail, node);
+                return;
+            }
+        }
+    }
+
+    std::optional<T> Dequeue() {
+        while (true) {
+            IntrusivePtr<Node> head = head_.Load();
+            IntrusivePtr<Node> next = head->next.Load();
+            if (!next) {
+                return std::nullopt;
+            }
+            IntrusivePtr<Node> tail = tail_.Load();
+            if (head.Get() == tail.Get()) {
+                tail_.CompareExchange(tail, next);
+            } else if (head_.CompareExchange(head, next)) {
+                // Losers may have read the value too, but only the winner returns it.
+                return *next->value;
+            }
+        }
+    }
+
+private:
+    struct Node : AtomicRefCounted<Node> {
+        Node() = default;
+        explicit Node(T value) : value(std::move(value)) {
+        }
+
+        const std::optional<T> value;
+        AtomicIntrusivePtr<Node, Domain> next;
+    };
+
+    AtomicIntrusivePtr<Node, Domain> head_;
+    AtomicIntrusivePtr<Node, Domain> tail_;
+};
@@ -0,0 +1,278 @@
+#pragma once
+
+#include "intrusive.h"
+
+#include <common/cache_line.h>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// IntrusiveObjectPool<T>: recycles the memory of objects whose last reference is gone. T derives
+// from PooledRefCounted<T>, whose deleter, ReturnToPool, remembers where the object came from;
+// the last DecRef destroys the object and hands its memory back there instead of to the heap,
+// and the next Allocate constructs a new object in it.
+//
+// Every thread has a cache of its own in every pool: a free list that only the thread touches,
+// and a queue that other threads push the memory of its objects to. So allocating and releasing
+// on one thread take no lock and no atomic read-modify-write, releasing an object on another
+// thread is one CAS, and the owner takes the whole queue with one exchange once its list runs
+// dry. A cache keeps at most capacity free slots in its list and as many in its queue; the rest
+// go back to the heap, and Trim() gives back everything the calling thread keeps.
+//
+// A copy of a pooled object is not pooled. The pool must outlive its objects. Threads past the
+// first kMaxThreads alive at once get plain heap objects.
+
+template <typename T>
+class IntrusiveObjectPool;
+
+struct ReturnToPool {
+    ReturnToPool() = default;
+    ReturnToPool(const ReturnToPool&) {
+    }
+    ReturnToPool& operator=(const ReturnToPool&) {
+        return *this;
+    }
+
+    template <typename T>
+    void operator()(T* object) {
+        if (home == nullptr) {
+            delete object;
+        } else {
+            IntrusiveObjectPool<T>::Return(home, object);
+        }
+    }
+
+    void* home = nullptr;  // The cache the memory goes back to.
+};
+
+template <typename Derived, typename Counter = AtomicCounter>
+using PooledRefCounted = RefCounted<Derived, Counter, ReturnToPool>;
+
+// Small indices for the threads alive right now. An exiting thread gives its index back, and
+// the next thread to take it inherits what the caches of that index keep.
+class PoolThreadIndex {
+public:
+    static constexpr uint32_t kNone = UINT32_MAX;
+
+    // kNone once the thread's index is given back: objects may still be released from later
+    // thread_local destructors.
+    static uint32_t Current() {
+        thread_local bool released = false;
+        if (released) {
+            return kNone;
+        }
+        thread_local Holder holder(&released);
+        return holder.index;
+    }
+
+private:
+    struct Registry {
+        std::mutex mutex;
+        std::vector<uint32_t> free;
+        uint32_t next = 0;
+    };
+
+    struct Holder {
+        explicit Holder(bool* released) : released(released) {
+            Registry& registry = Get();
+            std::lock_guard lock(registry.mutex);
+            if (registry.free.empty()) {
+                index = registry.next++;
+            } else {
+                index = registry.free.back();
+                registry.free.pop_back();
+            }
+        }
+
+        ~Holder() {
+            *released = true;
+            Registry& registry = Get();
+            std::lock_guard lock(registry.mutex);
+            registry.free.push_back(index);
+        }
+
+        uint32_t index;
+        bool* released;
+    };
+
+    static Registry& Get() {
+        static Registry* registry = new Registry;  // Outlives every thread.
+        return *registry;
+    }
+};
+
+template <typename T>
+class IntrusiveObjectPool {
+public:
+    static constexpr size_t kMaxThreads = 128;
+    static constexpr size_t kDefaultCapacity = 1024;
+
+    explicit IntrusiveObjectPool(size_t capacity = kDefaultCapacity) : capacity_(capacity) {
+    }
+
+    IntrusiveObjectPool(const IntrusiveObjectPool&) = delete;
+    IntrusiveObjectPool& operator=(const IntrusiveObjectPool&) = delete;
+
+    ~IntrusiveObjectPool() {
+        for (auto& slot : caches_) {
+            if (Cache* cache = slot.load(std::memory_order_acquire)) {
+                FreeAll(cache->local);
+                FreeAll(cache->remote.load(std::memory_order_acquire));
+                delete cache;
+            }
+        }
+    }
+
+    template <typename... Args>
+    IntrusivePtr<T> Allocate(Args&&... args) {
+        Cache* cache = LocalCache();
+        if (cache == nullptr) {
+            return IntrusivePtr<T>(new T(std::forward<Args>(args)...));
+        }
+        if (cache->local == nullptr) {
+            Drain(cache);
+        }
+        void* memory;
+        if (cache->local != nullptr) {
+            memory = cache->local;
+            cache->local = cache->local->next;
+            --cache->count;
+        } else {
+            memory = ::operator new(sizeof(T), std::align_val_t(alignof(T)));
+        }
+        T* object;
+        try {
+            object = new (memory) T(std::forward<Args>(args)...);
+        } catch (...) {
+            PushLocal(cache, memory);
+            throw;
+        }
+        object->GetDeleter().home = cache;
+        return IntrusivePtr<T>(object);
+    }
+
+    // Free slots the calling thread keeps, including those other threads gave back to it.
+    size_t NumCached() {
+        Cache* cache = LocalCache();
+        if (cache == nullptr) {
+            return 0;
+        }
+        return cache->count + cache->remote_count.load(std::memory_order_relaxed);
+    }
+
+    // Gives every free slot the calling thread keeps back to the heap.
+    void Trim() {
+        Cache* cache = LocalCache();
+        if (cache == nullptr) {
+            return;
+        }
+        Drain(cache);
+        FreeAll(cache->local);
+        cache->local = nullptr;
+        cache->count = 0;
+    }
+
+private:
+    friend struct ReturnToPool;
+
+    static_assert(std::is_same_v<decltype(std::declval<T&>().GetDeleter()), ReturnToPool&>,
+                  "T must derive from PooledRefCounted<T>");
+    static_assert(sizeof(T) >= sizeof(void*));
+
+    struct FreeSlot {
+        FreeSlot* next;
+    };
+
+    struct alignas(kCacheLineSize) Cache {
+        Cache(IntrusiveObjectPool* pool, uint32_t index) : pool(pool), index(index) {
+        }
+
+        IntrusiveObjectPool* pool;
+        uint32_t index;
+        FreeSlot* local = nullptr;  // Touched by the owner only.
+        size_t count = 0;
+
+        // Pushed to by other threads, taken whole by the owner, so there is no ABA.
+        alignas(kCacheLineSize) std::atomic<FreeSlot*> remote = nullptr;
+        std::atomic<size_t> remote_count = 0;
+    };
+
+    static void Return(void* home, T* object) {
+        auto cache = static_cast<Cache*>(home);
+        object->~T();
+        void* memory = object;
+        if (PoolThreadIndex::Current() == cache->index) {
+            PushLocal(cache, memory);
+        } else {
+            cache->pool->PushRemote(cache, memory);
+        }
+    }
+
+    static void PushLocal(Cache* cache, void* memory) {
+        if (cache->count >= cache->pool->capacity_) {
+            Free(memory);
+            return;
+        }
+        auto slot = static_cast<FreeSlot*>(memory);
+        slot->next = cache->local;
+        cache->local = slot;
+        ++cache->count;
+    }
+
+    void PushRemote(Cache* cache, void* memory) {
+        if (cache->remote_count.fetch_add(1, std::memory_order_relaxed) >= capacity_) {
+            cache->remote_count.fetch_sub(1, std::memory_order_relaxed);
+            Free(memory);
+            return;
+        }
+        auto slot = static_cast<FreeSlot*>(memory);
+        slot->next = cache->remote.load(std::memory_order_relaxed);
+        while (!cache->remote.compare_exchange_weak(slot->next, slot, std::memory_order_release,
+                                                    std::memory_order_relaxed)) {
+        }
+    }
+
+    // Moves the queue into the list, as far as the capacity lets it.
+    static void Drain(Cache* cache) {
+        FreeSlot* slot = cache->remote.exchange(nullptr, std::memory_order_acquire);
+        size_t taken = 0;
+        while (slot != nullptr) {
+            PushLocal(cache, std::exchange(slot, slot->next));
+            ++taken;
+        }
+        cache->remote_count.fetch_sub(taken, std::memory_order_relaxed);
+    }
+
+    Cache* LocalCache() {
+        uint32_t index = PoolThreadIndex::Current();
+        if (index >= kMaxThreads) {
+            return nullptr;
+        }
+        // Only the thread holding the index creates its cache.
+        Cache* cache = caches_[index].load(std::memory_order_relaxed);
+        if (cache == nullptr) {
+            cache = new Cache(this, index);
+            caches_[index].store(cache, std::memory_order_release);
+        }
+        return cache;
+    }
+
+    static void Free(void* memory) {
+        ::operator delete(memory, std::align_val_t(alignof(T)));
+    }
+
+    static void FreeAll(FreeSlot* slot) {
+        while (slot != nullptr) {
+            Free(std::exchange(slot, slot->next));
+        }
+    }
+
+    size_t capacity_;
+    std::atomic<Cache*> caches_[kMaxThreads] = {};
+};
@@ -0,0 +1,568 @@
+#pragma once
+
+#include "intrusive.h"
+
+#include <bitset>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <utility>
+#include <vector>
+
+// Persistent (immutable, structurally shared) containers on IntrusivePtr nodes. An update
+// returns a new version that shares every subtree it did not touch with the old one, so taking
+// a snapshot is copying one pointer and an update copies O(log n) nodes.
+//
+// PersistentVector<T> is a bit-partitioned trie with 32-way nodes and a separate tail leaf, as
+// in Clojure: PushBack, PopBack and Set, indexing in at most seven hops. PersistentMap<K, V> is
+// a hash array mapped trie in the CHAMP layout: every node keeps its entries and its subtrees
+// in two bitmap-indexed arrays, and keys whose 64-bit hashes are equal end up in a collision
+// node at the bottom.
+//
+// Transient() turns a container into a builder that updates nodes in place whenever it holds
+// the only reference to them, and copies them otherwise; Persistent() turns it back. A node
+// copied once is owned by the builder, so a batch of updates copies every node at most once,
+// and a builder made from a container that nobody else holds copies nothing at all.
+//
+// Nodes are counted with Counter, AtomicCounter by default, so versions may be handed to
+// readers on other threads. Builders belong to one thread.
+
+// Copy-on-write access to a node through the slot that owns it.
+template <typename Node>
+Node* EditableNode(IntrusivePtr<Node>& slot, bool in_place) {
+    if (!slot) {
+        slot = MakeIntrusive<Node>();
+    } else if (!in_place || slot->RefCount() != 1) {
+        slot = MakeIntrusive<Node>(*slot);
+    }
+    return slot.Get();
+}
+
+template <typename T, typename Counter = AtomicCounter>
+class TransientVector;
+
+template <typename T, typename Counter = AtomicCounter>
+class PersistentVector {
+public:
+    PersistentVector() = default;
+
+    size_t Size() const {
+        return trie_.size;
+    }
+    bool Empty() const {
+        return trie_.size == 0;
+    }
+
+    const T& operator[](size_t index) const {
+        assert(index < trie_.size);
+        return trie_.LeafFor(index)->values[index & Trie::kMask];
+    }
+
+    PersistentVector PushBack(T value) const {
+        PersistentVector result = *this;
+        result.trie_.PushBack(std::move(value), false);
+        return result;
+    }
+
+    PersistentVector PopBack() const {
+        PersistentVector result = *this;
+        result.trie_.PopBack(false);
+        return result;
+    }
+
+    PersistentVector Set(size_t index, T value) const {
+        PersistentVector result = *this;
+        result.trie_.Set(index, std::move(value), false);
+        return result;
+    }
+
+    TransientVector<T, Counter> Transient() const& {
+        return TransientVector<T, Counter>(trie_);
+    }
+    TransientVector<T, Counter> Transient() && {
+        return TransientVector<T, Counter>(std::move(trie_));
+    }
+
+    // Walks whole leaves rather than descending the trie for every element.
+    template <typename F>
+    void ForEach(F&& f) const {
+        for (size_t start = 0; start < trie_.size; start += Trie::kWidth) {
+            for (const T& value : trie_.LeafFor(start)->values) {
+                f(value);
+            }
+        }
+    }
+
+private:
+    friend class TransientVector<T, Counter>;
+
+    struct Node : RefCounted<Node, Counter, DefaultDelete> {
+        Node() = default;
+        Node(const Node& other) : children(other.children), values(other.values) {
+        }
+
+        std::vector<IntrusivePtr<Node>> children;  // Inner nodes.
+        std::vector<T> values;                     // Leaves.
+    };
+
+    struct Trie {
+        static constexpr size_t kBits = 5;
+        static constexpr size_t kWidth = size_t(1) << kBits;
+        static constexpr size_t kMask = kWidth - 1;
+
+        // Elements before the tail, a multiple of kWidth.
+        size_t TailOffset() const {
+            return size < kWidth ? 0 : ((size - 1) >> kBits) << kBits;
+        }
+
+        const Node* LeafFor(size_t index) const {
+            if (index >= TailOffset()) {
+                return tail.Get();
+            }
+            const Node* node = root.Get();
+            for (size_t level = shift; level > 0; level -= kBits) {
+                node = node->children[(index >> level) & kMask].Get();
+            }
+            return node;
+        }
+
+        void PushBack(T value, bool in_place) {
+            if (size - TailOffset() < kWidth) {
+                EditableNode(tail, in_place)->values.push_back(std::move(value));
+                ++size;
+                return;
+            }
+            // The tail is full: it moves into the trie and a new one starts.
+            IntrusivePtr<Node> full = std::move(tail);
+            if ((size >> kBits) > (size_t(1) << shift)) {
+                IntrusivePtr<Node> new_root = MakeIntrusive<Node>();
+                new_root->children.push_back(std::move(root));
+                new_root->children.push_back(NewPath(shift, std::move(full)));
+                root = std::move(new_root);
+                shift += kBits;
+            } else {
+                PushTail(shift, EditableNode(root, in_place), std::move(full), in_place);
+            }
+            tail = MakeIntrusive<Node>();
+            tail->values.push_back(std::move(value));
+            ++size;
+        }
+
+        void PopBack(bool in_place) {
+            assert(size > 0);
+            if (size == 1) {
+                *this = Trie();
+                return;
+            }
+            if (size - TailOffset() > 1) {
+                EditableNode(tail, in_place)->values.pop_back();
+                --size;
+                return;
+            }
+            // The tail empties: the last leaf of the trie becomes the new tail.
+            IntrusivePtr<Node> leaf(const_cast<Node*>(LeafFor(size - 2)));
+            PopTail(shift, root, in_place);
+            if (root && shift > kBits && root->children.size() == 1) {
+                IntrusivePtr<Node> child = root->children[0];
+                root = std::move(child);
+                shift -= kBits;
+            }
+            tail = std::move(leaf);
+            --size;
+        }
+
+        void Set(size_t index, T value, bool in_place) {
+            assert(index < size);
+            Node* node;
+            if (index >= TailOffset()) {
+                node = EditableNode(tail, in_place);
+            } else {
+                node = EditableNode(root, in_place);
+                for (size_t level = shift; level > 0; level -= kBits) {
+                    node = EditableNode(node->children[(index >> level) & kMask], in_place);
+                }
+            }
+            node->values[index & kMask] = std::move(value);
+        }
+
+        static IntrusivePtr<Node> NewPath(size_t level, IntrusivePtr<Node> leaf) {
+            if (level == 0) {
+                return leaf;
+            }
+            IntrusivePtr<Node> node = MakeIntrusive<Node>();
+            node->children.push_back(NewPath(level - kBits, std::move(leaf)));
+            return node;
+        }
+
+        // size is still the old one here, so size - 1 is the last element of the leaf.
+        void PushTail(size_t level, Node* parent, IntrusivePtr<Node> leaf, bool in_place) {
+            size_t index = ((size - 1) >> level) & kMask;
+            if (level == kBits) {
+                parent->children.push_back(std::move(leaf));
+            } else if (index < parent->children.size()) {
+                Node* child = EditableNode(parent->children[index], in_place);
+                PushTail(level - kBits, child, std::move(leaf), in_place);
+            } else {
+                parent->children.push_back(NewPath(level - kBits, std::move(leaf)));
+            }
+        }
+
+        // Drops the last leaf below slot, and slot itself if that was the only leaf there.
+        void PopTail(size_t level, IntrusivePtr<Node>& slot, bool in_place) {
+            if (((size - 2) & ((size_t(1) << (level + kBits)) - 1)) < kWidth) {
+                slot.Reset();
+                return;
+            }
+            Node* node = EditableNode(slot, in_place);
+            if (level == kBits) {
+                node->children.pop_back();
+                return;
+            }
+            size_t index = ((size - 2) >> level) & kMask;
+            PopTail(level - kBits, node->children[index], in_place);
+            if (!node->children[index]) {
+                node->children.pop_back();
+            }
+        }
+
+        size_t size = 0;
+        size_t shift = kBits;
+        IntrusivePtr<Node> root;
+        IntrusivePtr<Node> tail;
+    };
+
+    explicit PersistentVector(Trie trie) : trie_(std::move(trie)) {
+    }
+
+    Trie trie_;
+};
+
+template <typename T, typename Counter>
+class TransientVector {
+public:
+    size_t Size() const {
+        return trie_.size;
+    }
+
+    const T& operator[](size_t index) const {
+        assert(index < trie_.size);
+        return trie_.LeafFor(index)->values[index & Trie::kMask];
+    }
+
+    void PushBack(T value) {
+        trie_.PushBack(std::move(value), true);
+    }
+    void PopBack() {
+        trie_.PopBack(true);
+    }
+    void Set(size_t index, T value) {
+        trie_.Set(index, std::move(value), true);
+    }
+
+    // Leaves the builder empty.
+    PersistentVector<T, Counter> Persistent() {
+        return PersistentVector<T, Counter>(std::exchange(trie_, Trie()));
+    }
+
+private:
+    using Trie = typename PersistentVector<T, Counter>::Trie;
+
+    friend class PersistentVector<T, Counter>;
+
+    explicit TransientVector(Trie trie) : trie_(std::move(trie)) {
+    }
+
+    Trie trie_;
+};
+
+template <typename K, typename V, typename Hash = std::hash<K>,
+          typename KeyEqual = std::equal_to<K>, typename Counter = AtomicCounter>
+class TransientMap;
+
+template <typename K, typename V, typename Hash = std::hash<K>,
+          typename KeyEqual = std::equal_to<K>, typename Counter = AtomicCounter>
+class PersistentMap {
+public:
+    PersistentMap() = default;
+
+    size_t Size() const {
+        return trie_.size;
+    }
+    bool Empty() const {
+        return trie_.size == 0;
+    }
+
+    // Null if the key is missing.
+    const V* Find(const K& key) const {
+        return trie_.Find(key);
+    }
+    bool Contains(const K& key) const {
+        return trie_.Find(key) != nullptr;
+    }
+
+    PersistentMap Set(K key, V value) const {
+        PersistentMap result = *this;
+        result.trie_.Set(std::move(key), std::move(value), false);
+        return result;
+    }
+
+    PersistentMap Erase(const K& key) const {
+        PersistentMap result = *this;
+        result.trie_.Erase(key, false);
+        return result;
+    }
+
+    TransientMap<K, V, Hash, KeyEqual, Counter> Transient() const& {
+        return TransientMap<K, V, Hash, KeyEqual, Counter>(trie_);
+    }
+    TransientMap<K, V, Hash, KeyEqual, Counter> Transient() && {
+        return TransientMap<K, V, Hash, KeyEqual, Counter>(std::move(trie_));
+    }
+
+    // Calls f(key, value) for every entry, in no particular order.
+    template <typename F>
+    void ForEach(F&& f) const {
+        if (trie_.root) {
+            Trie::ForEach(*trie_.root, f);
+        }
+    }
+
+private:
+    friend class TransientMap<K, V, Hash, KeyEqual, Counter>;
+
+    struct Node : RefCounted<Node, Counter, DefaultDelete> {
+        Node() = default;
+        Node(const Node& other)
+            : data_map(other.data_map),
+              node_map(other.node_map),
+              entries(other.entries),
+              children(other.children) {
+        }
+
+        uint32_t data_map = 0;
+        uint32_t node_map = 0;
+        std::vector<std::pair<K, V>> entries;      // In bit order; unordered in collision nodes.
+        std::vector<IntrusivePtr<Node>> children;  // In bit order.
+    };
+
+    struct Trie {
+        static constexpr size_t kBits = 5;
+        static constexpr size_t kHashBits = 64;
+
+        static uint32_t Bit(size_t hash, size_t shift) {
+            return uint32_t(1) << ((hash >> shift) & 31);
+        }
+
+        static size_t Index(uint32_t map, uint32_t bit) {
+            return std::bitset<32>(map & (bit - 1)).count();
+        }
+
+        static size_t HashOf(const K& key) {
+            return static_cast<size_t>(Hash()(key));
+        }
+
+        const V* Find(const K& key) const {
+            size_t hash = HashOf(key);
+            const Node* node = root.Get();
+            for (size_t shift = 0; node != nullptr; shift += kBits) {
+                if (shift >= kHashBits) {
+                    for (const auto& entry : node->entries) {
+                        if (KeyEqual()(entry.first, key)) {
+                            return &entry.second;
+                        }
+                    }
+                    return nullptr;
+                }
+                uint32_t bit = Bit(hash, shift);
+                if (node->data_map & bit) {
+                    const auto& entry = node->entries[Index(node->data_map, bit)];
+                    return KeyEqual()(entry.first, key) ? &entry.second : nullptr;
+                }
+                if (!(node->node_map & bit)) {
+                    return nullptr;
+                }
+                node = node->children[Index(node->node_map, bit)].Get();
+            }
+            return nullptr;
+        }
+
+        void Set(K key, V value, bool in_place) {
+            size_t hash = HashOf(key);
+            if (Insert(root, std::move(key), std::move(value), hash, 0, in_place)) {
+                ++size;
+            }
+        }
+
+        void Erase(const K& key, bool in_place) {
+            // Checked first, so erasing a missing key copies nothing.
+            if (Find(key) == nullptr) {
+                return;
+            }
+            Remove(root, key, HashOf(key), 0, in_place);
+            if (root->entries.empty() && root->children.empty()) {
+                root.Reset();
+            }
+            --size;
+        }
+
+        // Returns whether the key was new.
+        static bool Insert(IntrusivePtr<Node>& slot, K key, V value, size_t hash, size_t shift,
+                           bool in_place) {
+            Node* node = EditableNode(slot, in_place);
+            if (shift >= kHashBits) {
+                for (auto& entry : node->entries) {
+                    if (KeyEqual()(entry.first, key)) {
+                        entry.second = std::move(value);
+                        return false;
+                    }
+                }
+                node->entries.emplace_back(std::move(key), std::move(value));
+                return true;
+            }
+            uint32_t bit = Bit(hash, shift);
+            if (node->data_map & bit) {
+                size_t index = Index(node->data_map, bit);
+                auto& entry = node->entries[index];
+                if (KeyEqual()(entry.first, key)) {
+                    entry.second = std::move(value);
+                    return false;
+                }
+                // Two keys on one fragment: both move one level down.
+                std::pair<K, V> other = std::move(entry);
+                node->entries.erase(node->entries.begin() + index);
+                node->data_map &= ~bit;
+                size_t other_hash = HashOf(other.first);
+                IntrusivePtr<Node> child = MergeTwo(std::move(other), other_hash,
+                                                    {std::move(key), std::move(value)}, hash,
+                                                    shift + kBits);
+                node->children.insert(node->children.begin() + Index(node->node_map, bit),
+                                      std::move(child));
+                node->node_map |= bit;
+                return true;
+            }
+            if (node->node_map & bit) {
+                auto& child = node->children[Index(node->node_map, bit)];
+                return Insert(child, std::move(key), std::move(value), hash, shift + kBits,
+                              in_place);
+            }
+            node->entries.emplace(node->entries.begin() + Index(node->data_map, bit),
+                                  std::move(key), std::move(value));
+            node->data_map |= bit;
+            return true;
+        }
+
+        static IntrusivePtr<Node> MergeTwo(std::pair<K, V> first, size_t first_hash,
+                                           std::pair<K, V> second, size_t second_hash,
+                                           size_t shift) {
+            IntrusivePtr<Node> node = MakeIntrusive<Node>();
+            if (shift >= kHashBits) {
+                node->entries.push_back(std::move(first));
+                node->entries.push_back(std::move(second));
+                return node;
+            }
+            uint32_t first_bit = Bit(first_hash, shift);
+            uint32_t second_bit = Bit(second_hash, shift);
+            if (first_bit == second_bit) {
+                node->children.push_back(MergeTwo(std::move(first), first_hash,
+                                                  std::move(second), second_hash,
+                                                  shift + kBits));
+                node->node_map = first_bit;
+                return node;
+            }
+            if (second_bit < first_bit) {
+                std::swap(first, second);
+            }
+            node->entries.push_back(std::move(first));
+            node->entries.push_back(std::move(second));
+            node->data_map = first_bit | second_bit;
+            return node;
+        }
+
+        // The key is known to be there. A subtree left with a single entry is folded into its
+        // parent, which keeps the trie as shallow as the keys allow.
+        static void Remove(IntrusivePtr<Node>& slot, const K& key, size_t hash, size_t shift,
+                           bool in_place) {
+            Node* node = EditableNode(slot, in_place);
+            if (shift >= kHashBits) {
+                for (auto it = node->entries.begin(); it != node->entries.end(); ++it) {
+                    if (KeyEqual()(it->first, key)) {
+                        node->entries.erase(it);
+                        return;
+                    }
+                }
+                return;
+            }
+            uint32_t bit = Bit(hash, shift);
+            if (node->data_map & bit) {
+                node->entries.erase(node->entries.begin() + Index(node->data_map, bit));
+                node->data_map &= ~bit;
+                return;
+            }
+            size_t index = Index(node->node_map, bit);
+            IntrusivePtr<Node>& child = node->children[index];
+            Remove(child, key, hash, shift + kBits, in_place);
+            if (child->children.empty() && child->entries.size() == 1) {
+                // Remove left the child ours either way.
+                std::pair<K, V> last = std::move(child->entries[0]);
+                node->children.erase(node->children.begin() + index);
+                node->node_map &= ~bit;
+                node->entries.insert(node->entries.begin() + Index(node->data_map, bit),
+                                     std::move(last));
+                node->data_map |= bit;
+            }
+        }
+
+        template <typename F>
+        static void ForEach(const Node& node, F& f) {
+            for (const auto& [key, value] : node.entries) {
+                f(key, value);
+            }
+            for (const auto& child : node.children) {
+                ForEach(*child, f);
+            }
+        }
+
+        size_t size = 0;
+        IntrusivePtr<Node> root;
+    };
+
+    explicit PersistentMap(Trie trie) : trie_(std::move(trie)) {
+    }
+
+    Trie trie_;
+};
+
+template <typename K, typename V, typename Hash, typename KeyEqual, typename Counter>
+class TransientMap {
+public:
+    size_t Size() const {
+        return trie_.size;
+    }
+
+    const V* Find(const K& key) const {
+        return trie_.Find(key);
+    }
+
+    void Set(K key, V value) {
+        trie_.Set(std::move(key), std::move(value), true);
+    }
+    void Erase(const K& key) {
+        trie_.Erase(key, true);
+    }
+
+    // Leaves the builder empty.
+    PersistentMap<K, V, Hash, KeyEqual, Counter> Persistent() {
+        return PersistentMap<K, V, Hash, KeyEqual, Counter>(std::exchange(trie_, Trie()));
+    }
+
+private:
+    using Trie = typename PersistentMap<K, V, Hash, KeyEqual, Counter>::Trie;
+
+    friend class PersistentMap<K, V, Hash, KeyEqual, Counter>;
+
+    explicit TransientMap(Trie trie) : trie_(std::move(trie)) {
+    }
+
+    Trie trie_;
+};
@@ -1,10 +1,15 @@
 #include "intrusive.h"
+#include "object_pool.h"
 
 #include <catch.hpp>
 
 #include "allocations_checker.h"
 
+#include <common/tracking_allocator.h>
+
+#include <stdexcept>
 #include <string>
+#include <vector>
 
 ////////////////////////////////////////////////////////////////////////////////
 
@@ -263,6 +268,118 @@ TEST_CASE("No copies") {
     IntrusivePtr<Pinned> p(new Pinned(1));
 }
 
+struct CompactInt : CompactRefCounted<CompactInt> {
+    CompactInt(int value) : value{value} {
+    }
+
+    int value = 0;
+};
+
+TEST_CASE("Compact counter") {
+    static_assert(sizeof(CompactInt) == 8);
+    static_assert(sizeof(CompactInt) < sizeof(MyInt));
+
+    IntrusivePtr<CompactInt> a(new CompactInt(42));
+    {
+        IntrusivePtr<CompactInt> b = a;
+        IntrusivePtr<CompactInt> c = b;
+        REQUIRE(a.UseCount() == 3);
+    }
+    REQUIRE(a.UseCount() == 1);
+    REQUIRE(a->value == 42);
+}
+
+TEST_CASE("Moves do not count") {
+    static_assert(std::is_nothrow_move_constructible_v<IntrusivePtr<MyInt>>);
+    static_assert(std::is_nothrow_move_assignable_v<IntrusivePtr<MyInt>>);
+    static_assert(kIsTriviallyRelocatable<IntrusivePtr<MyInt>>);
+
+    IntrusivePtr<MyInt> a(new MyInt(1));
+    IntrusivePtr<MyInt> b(new MyInt(2));
+    a.Swap(b);
+    REQUIRE(a->value == 2);
+    REQUIRE(b->value == 1);
+
+    IntrusivePtr<MyInt> c = std::move(a);
+    b = std::move(c);
+    b = std::move(b);
+    REQUIRE(b->value == 2);
+    REQUIRE(b.UseCount() == 1);
+    REQUIRE(a.Get() == nullptr);
+}
+
+struct AllocatedInt : SimpleRefCounted<AllocatedInt, AllocatorDelete<TrackingAllocator<int>>> {
+    AllocatedInt(int value) : value{value} {
+    }
+
+    int value = 0;
+};
+
+TEST_CASE("AllocateIntrusive") {
+    // MakeIntrusive<AllocatedInt> does not compile: the object would not be in a block.
+    static_assert(UsesAllocatorDelete<AllocatedInt>::value);
+    static_assert(!UsesAllocatorDelete<MyInt>::value);
+    // Nor does AllocateIntrusive of a type another deleter frees, or with another allocator.
+    static_assert(FreedByAllocator<AllocatedInt, TrackingAllocator<int>>::value);
+    static_assert(FreedByAllocator<AllocatedInt, TrackingAllocator<char>>::value);
+    static_assert(!FreedByAllocator<AllocatedInt, std::allocator<int>>::value);
+    static_assert(!FreedByAllocator<MyInt, TrackingAllocator<int>>::value);
+
+    AllocationStats stats;
+    {
+        EXPECT_ZERO_ALLOCATIONS(
+            auto a = AllocateIntrusive<AllocatedInt>(TrackingAllocator<int>(&stats), 42));
+        auto b = AllocateIntrusive<AllocatedInt>(TrackingAllocator<char>(&stats), 43);
+        IntrusivePtr<AllocatedInt> c = b;
+        REQUIRE(b.UseCount() == 2);
+        REQUIRE(c->value == 43);
+    }
+    REQUIRE(stats.allocations == 2);
+    REQUIRE(stats.deallocations == 2);
+}
+
+struct DeferredInt : SimpleRefCounted<DeferredInt, DeferredDelete<>> {
+    static inline int alive = 0;
+
+    DeferredInt() {
+        ++alive;
+    }
+
+    ~DeferredInt() {
+        --alive;
+    }
+
+    IntrusivePtr<DeferredInt> next;
+};
+
+TEST_CASE("Deferred delete") {
+    {
+        IntrusivePtr<DeferredInt> head;
+        for (int i = 0; i < 1000; ++i) {
+            auto node = MakeIntrusive<DeferredInt>();
+            node->next = std::move(head);
+            head = std::move(node);
+        }
+        IntrusivePtr<DeferredInt> copy = head;
+    }
+    REQUIRE(DeferredInt::alive == 1000);
+    REQUIRE(DrainReclaimQueue() == 1000);
+    REQUIRE(DeferredInt::alive == 0);
+}
+
+struct IsolatedInt : IsolatedRefCounted<IsolatedInt> {
+    int value = 0;
+};
+
+TEST_CASE("Isolated counter") {
+    auto a = MakeIntrusive<IsolatedInt>();
+    IntrusivePtr<IsolatedInt> b = a;
+    REQUIRE(a.UseCount() == 2);
+    auto address = reinterpret_cast<uintptr_t>(a.Get());
+    REQUIRE(address % kCacheLineSize == 0);
+    REQUIRE(reinterpret_cast<uintptr_t>(&a->value) - address == kCacheLineSize);
+}
+
 template <typename T>
 class ObjectInPool;
 
@@ -385,4 +502,140 @@ TEST_CASE("Object pool") {
         REQUIRE(strs.NumAvailable() == 3);
         REQUIRE(strs.NumInUse() == 1);
     }
-}
\ No newline at end of file
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+struct PooledString : PooledRefCounted<PooledString>, std::string {
+    static inline int alive = 0;
+
+    PooledString(const char* str) : std::string(str) {
+        if (*str == '!') {
+            throw std::runtime_error("no");
+        }
+        ++alive;
+    }
+    PooledString(const PooledString& other)
+        : PooledRefCounted<PooledString>(other), std::string(other) {
+        ++alive;
+    }
+    ~PooledString() {
+        --alive;
+    }
+};
+
+TEST_CASE("IntrusiveObjectPool") {
+    IntrusiveObjectPool<PooledString> pool(3);
+
+    SECTION("Memory is reused") {
+        auto a = pool.Allocate("first");
+        PooledString* address = a.Get();
+        a.Reset();
+        REQUIRE(PooledString::alive == 0);
+        REQUIRE(pool.NumCached() == 1);
+        EXPECT_ZERO_ALLOCATIONS(a = pool.Allocate("second"));
+        REQUIRE(a.Get() == address);
+        REQUIRE(*a == "second");
+        REQUIRE(pool.NumCached() == 0);
+    }
+
+    SECTION("Capacity and trimming") {
+        {
+            std::vector<IntrusivePtr<PooledString>> strs;
+            for (int i = 0; i < 5; ++i) {
+                strs.push_back(pool.Allocate("str"));
+            }
+            REQUIRE(PooledString::alive == 5);
+        }
+        REQUIRE(PooledString::alive == 0);
+        REQUIRE(pool.NumCached() == 3);
+        pool.Trim();
+        REQUIRE(pool.NumCached() == 0);
+        EXPECT_ONE_ALLOCATION(pool.Allocate("str"));
+        REQUIRE(pool.NumCached() == 1);
+    }
+
+    SECTION("Copies are not pooled") {
+        auto a = pool.Allocate("first");
+        {
+            auto copy = MakeIntrusive<PooledString>(*a);
+            REQUIRE(copy->GetDeleter().home == nullptr);
+            REQUIRE(*copy == "first");
+        }
+        REQUIRE(pool.NumCached() == 0);
+    }
+
+    SECTION("Throwing constructor") {
+        REQUIRE_THROWS(pool.Allocate("!"));
+        REQUIRE(pool.NumCached() == 1);
+        REQUIRE(PooledString::alive == 0);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+struct WeakInt : WeakRefCounted<WeakInt> {
+    static inline int alive = 0;
+
+    explicit WeakInt(int value) : value(value) {
+        ++alive;
+    }
+    ~WeakInt() {
+        --alive;
+    }
+
+    int value;
+};
+
+TEST_CASE("IntrusiveWeakPtr") {
+    static_assert(sizeof(WeakInt) == sizeof(AtomicRefCounted<WeakInt>) + sizeof(int64_t));
+
+    SECTION("Side table is allocated on first use") {
+        IntrusivePtr<WeakInt> a;
+        EXPECT_ONE_ALLOCATION(a = MakeIntrusive<WeakInt>(1));
+        IntrusivePtr<WeakInt> b = a;
+        REQUIRE(a.UseCount() == 2);
+
+        IntrusiveWeakPtr<WeakInt> weak;
+        EXPECT_ONE_ALLOCATION(weak = a);
+        REQUIRE(a.UseCount() == 2);
+        REQUIRE(weak.UseCount() == 2);
+        EXPECT_ZERO_ALLOCATIONS(IntrusiveWeakPtr<WeakInt> other(a); other = weak);
+
+        b.Reset();
+        REQUIRE(a.UseCount() == 1);
+        IntrusivePtr<WeakInt> locked = weak.Lock();
+        REQUIRE(locked.Get() == a.Get());
+        REQUIRE(locked->value == 1);
+        REQUIRE(a.UseCount() == 2);
+    }
+
+    SECTION("Expiry") {
+        auto a = MakeIntrusive<WeakInt>(2);
+        IntrusiveWeakPtr<WeakInt> weak(a);
+        IntrusiveWeakPtr<WeakInt> copy = weak;
+        a.Reset();
+        REQUIRE(WeakInt::alive == 0);
+        REQUIRE(weak.Expired());
+        REQUIRE(copy.UseCount() == 0);
+        REQUIRE(!weak.Lock());
+
+        IntrusiveWeakPtr<WeakInt> moved = std::move(copy);
+        REQUIRE(moved.Expired());
+        moved.Reset();
+        REQUIRE(IntrusiveWeakPtr<WeakInt>().Expired());
+    }
+
+    SECTION("Table outlives weak pointers") {
+        IntrusiveWeakPtr<WeakInt> weak;
+        {
+            auto a = MakeIntrusive<WeakInt>(3);
+            weak = a;
+            weak.Reset();
+            REQUIRE(a.UseCount() == 1);
+            weak = a;
+        }
+        REQUIRE(weak.Expired());
+        REQUIRE(WeakInt::alive == 0);
+    }
+}
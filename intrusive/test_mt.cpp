@@ -0,0 +1,313 @@
+#include "intrusive.h"
+#include "atomic.h"
+#include "lock_free.h"
+#include "object_pool.h"
+#include "persistent.h"
+
+#include <catch.hpp>
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+struct Node : AtomicRefCounted<Node> {
+    static inline std::atomic<int> alive = 0;
+
+    explicit Node(int value) : value(value) {
+        ++alive;
+    }
+
+    ~Node() {
+        value = -1;
+        --alive;
+    }
+
+    int value;
+};
+
+constexpr int kNumThreads = 4;
+constexpr int kNumIters = 20000;
+
+template <typename Domain>
+void CollectAll() {
+    for (int i = 0; i < 3; ++i) {
+        Domain::Collect();
+    }
+}
+
+}  // namespace
+
+TEMPLATE_TEST_CASE("Retired objects wait for readers", "", HazardPointers, Epochs) {
+    int alive = Node::alive;
+    std::atomic<Node*> shared = new Node(1);
+    {
+        typename TestType::Guard guard;
+        Node* node = guard.Protect(shared);
+        TestType::Retire(shared.exchange(nullptr),
+                         [](void* ptr) { delete static_cast<Node*>(ptr); });
+        CollectAll<TestType>();
+        REQUIRE(Node::alive == alive + 1);
+        REQUIRE(node->value == 1);
+    }
+    CollectAll<TestType>();
+    REQUIRE(Node::alive == alive);
+}
+
+TEMPLATE_TEST_CASE("AtomicIntrusivePtr", "", HazardPointers, Epochs) {
+    {
+        AtomicIntrusivePtr<Node, TestType> slot;
+        REQUIRE(slot.Load().Get() == nullptr);
+        slot.Store(MakeIntrusive<Node>(1));
+        auto old = slot.Exchange(MakeIntrusive<Node>(2));
+        REQUIRE(old->value == 1);
+
+        IntrusivePtr<Node> expected = old;
+        REQUIRE_FALSE(slot.CompareExchange(expected, MakeIntrusive<Node>(3)));
+        REQUIRE(expected->value == 2);
+        REQUIRE(slot.CompareExchange(expected, MakeIntrusive<Node>(4)));
+        REQUIRE(slot.Load()->value == 4);
+    }
+    CollectAll<TestType>();
+    REQUIRE(Node::alive == 0);
+}
+
+// Readers load and dereference while writers keep replacing the value.
+TEMPLATE_TEST_CASE("Loads race with stores", "", HazardPointers, Epochs) {
+    {
+        AtomicIntrusivePtr<Node, TestType> slot(MakeIntrusive<Node>(0));
+        std::atomic<int> failures = 0;
+        std::vector<std::thread> threads;
+        for (int i = 0; i < kNumThreads; ++i) {
+            threads.emplace_back([&slot, &failures, i] {
+                for (int j = 0; j < kNumIters; ++j) {
+                    if (i == 0) {
+                        slot.Store(MakeIntrusive<Node>(j));
+                    } else if (slot.Load()->value < 0) {
+                        ++failures;
+                    }
+                }
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        REQUIRE(failures == 0);
+    }
+    CollectAll<TestType>();
+    REQUIRE(Node::alive == 0);
+}
+
+TEMPLATE_TEST_CASE("Treiber stack", "", HazardPointers, Epochs) {
+    TreiberStack<int, TestType> stack;
+    std::atomic<long long> popped_sum = 0;
+    std::vector<std::thread> threads;
+    for (int i = 0; i < kNumThreads; ++i) {
+        threads.emplace_back([&] {
+            long long sum = 0;
+            for (int j = 1; j <= kNumIters; ++j) {
+                stack.Push(j);
+                if (auto value = stack.Pop()) {
+                    sum += *value;
+                }
+            }
+            popped_sum += sum;
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    while (auto value = stack.Pop()) {
+        popped_sum += *value;
+    }
+    REQUIRE(popped_sum == 1LL * kNumThreads * kNumIters * (kNumIters + 1) / 2);
+}
+
+// Every consumer must see each producer's values in the order they were enqueued.
+TEMPLATE_TEST_CASE("Michael-Scott queue", "", HazardPointers, Epochs) {
+    MichaelScottQueue<std::pair<int, int>, TestType> queue;
+    REQUIRE_FALSE(queue.Dequeue());
+
+    constexpr int kNumProducers = 2;
+    std::atomic<int> consumed = 0;
+    std::atomic<int> failures = 0;
+    std::vector<std::thread> threads;
+    for (int i = 0; i < kNumProducers; ++i) {
+        threads.emplace_back([&queue, i] {
+            for (int j = 0; j < kNumIters; ++j) {
+                queue.Enqueue({i, j});
+            }
+        });
+    }
+    for (int i = 0; i < kNumThreads - kNumProducers; ++i) {
+        threads.emplace_back([&] {
+            std::vector<int> last(kNumProducers, -1);
+            while (consumed < kNumProducers * kNumIters) {
+                if (auto value = queue.Dequeue()) {
+                    auto [producer, seq] = *value;
+                    if (seq <= last[producer]) {
+                        ++failures;
+                    }
+                    last[producer] = seq;
+                    ++consumed;
+                }
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    REQUIRE(failures == 0);
+    REQUIRE(consumed == kNumProducers * kNumIters);
+    REQUIRE_FALSE(queue.Dequeue());
+}
+
+TEST_CASE("Persistent snapshots are shared across threads") {
+    // Version n holds n, n + 1, ... in every slot; readers check their snapshots while the
+    // writer keeps building new versions out of nodes the readers still hold.
+    std::mutex mutex;
+    PersistentVector<int> current;
+    std::atomic<bool> done = false;
+    std::atomic<int> failures = 0;
+
+    std::vector<std::thread> threads;
+    for (int i = 0; i < kNumThreads - 1; ++i) {
+        threads.emplace_back([&] {
+            while (!done) {
+                PersistentVector<int> snapshot;
+                {
+                    std::lock_guard lock(mutex);
+                    snapshot = current;
+                }
+                for (size_t j = 0; j < snapshot.Size(); ++j) {
+                    if (snapshot[j] != snapshot[0] + static_cast<int>(j)) {
+                        ++failures;
+                    }
+                }
+            }
+        });
+    }
+    for (int version = 0; version < 200; ++version) {
+        PersistentVector<int> base;
+        {
+            std::lock_guard lock(mutex);
+            base = current;
+        }
+        auto builder = base.Transient();
+        for (size_t j = 0; j < builder.Size(); ++j) {
+            builder.Set(j, builder[j] + 1);
+        }
+        builder.PushBack(builder.Size() == 0 ? 1 : builder[builder.Size() - 1] + 1);
+        auto next = builder.Persistent();
+        std::lock_guard lock(mutex);
+        current = std::move(next);
+    }
+    done = true;
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    REQUIRE(failures == 0);
+    REQUIRE(current.Size() == 200);
+    REQUIRE(current[0] == 200);
+}
+
+struct Pooled : PooledRefCounted<Pooled> {
+    explicit Pooled(int value) : value(value) {
+        ++alive;
+    }
+    ~Pooled() {
+        --alive;
+    }
+
+    static inline std::atomic<int> alive = 0;
+    int value;
+};
+
+TEST_CASE("Objects return to the pool of their thread") {
+    IntrusiveObjectPool<Pooled> pool(kNumIters);
+    std::atomic<int> failures = 0;
+    {
+        // Every thread allocates its own objects and releases those of its neighbour.
+        std::vector<std::vector<IntrusivePtr<Pooled>>> objects(kNumThreads);
+        std::vector<std::thread> threads;
+        for (int i = 0; i < kNumThreads; ++i) {
+            for (int j = 0; j < 1000; ++j) {
+                objects[i].push_back(pool.Allocate(j));
+            }
+        }
+        for (int i = 0; i < kNumThreads; ++i) {
+            threads.emplace_back([&, i] {
+                objects[(i + 1) % kNumThreads].clear();
+                for (int j = 0; j < kNumIters; ++j) {
+                    auto object = pool.Allocate(j);
+                    if (object->value != j) {
+                        ++failures;
+                    }
+                }
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+    }
+    REQUIRE(failures == 0);
+    REQUIRE(Pooled::alive == 0);
+    // Everything allocated here came back through the other threads' queues.
+    REQUIRE(pool.NumCached() == kNumThreads * 1000);
+}
+
+struct Weakly : WeakRefCounted<Weakly> {
+    int value = 42;
+};
+
+TEST_CASE("Weak locks race with the last release") {
+    std::atomic<int> failures = 0;
+    for (int iter = 0; iter < kNumIters / 10; ++iter) {
+        auto object = MakeIntrusive<Weakly>();
+        IntrusiveWeakPtr<Weakly> weak(object);
+        std::vector<std::thread> threads;
+        for (int i = 0; i < kNumThreads - 1; ++i) {
+            threads.emplace_back([weak, &failures] {
+                if (auto locked = weak.Lock(); locked && locked->value != 42) {
+                    ++failures;
+                }
+            });
+        }
+        object.Reset();
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        if (!weak.Expired()) {
+            ++failures;
+        }
+    }
+    REQUIRE(failures == 0);
+}
+
+TEST_CASE("Side table is created while the count changes") {
+    std::atomic<int> failures = 0;
+    for (int iter = 0; iter < kNumIters / 10; ++iter) {
+        auto object = MakeIntrusive<Weakly>();
+        std::vector<std::thread> threads;
+        for (int i = 0; i < kNumThreads; ++i) {
+            threads.emplace_back([object, &failures] {
+                IntrusivePtr<Weakly> copy = object;
+                IntrusiveWeakPtr<Weakly> weak(copy);
+                if (!weak.Lock()) {
+                    ++failures;
+                }
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        if (object.UseCount() != 1) {
+            ++failures;
+        }
+    }
+    REQUIRE(failures == 0);
+}
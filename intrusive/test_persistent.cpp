@@ -0,0 +1,222 @@
+#include "persistent.h"
+
+#include <catch.hpp>
+
+#include "allocations_checker.h"
+
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+template <typename T, typename Counter>
+std::vector<T> ToVector(const PersistentVector<T, Counter>& vec) {
+    std::vector<T> result;
+    vec.ForEach([&result](const T& value) { result.push_back(value); });
+    for (size_t i = 0; i < vec.Size(); ++i) {
+        REQUIRE(vec[i] == result[i]);
+    }
+    return result;
+}
+
+template <typename Map>
+std::map<int, std::string> ToMap(const Map& map) {
+    std::map<int, std::string> result;
+    map.ForEach([&result](int key, const std::string& value) { result.emplace(key, value); });
+    return result;
+}
+
+struct CollidingHash {
+    size_t operator()(int key) const {
+        return key % 3;  // Equal 64-bit hashes all the way down.
+    }
+};
+
+}  // namespace
+
+TEST_CASE("PersistentVector") {
+    SECTION("Versions stay intact") {
+        std::vector<PersistentVector<int>> versions(1);
+        std::vector<std::vector<int>> expected(1);
+        for (int i = 0; i < 3000; ++i) {
+            versions.push_back(versions.back().PushBack(i));
+            expected.push_back(expected.back());
+            expected.back().push_back(i);
+        }
+        for (size_t i = 0; i < versions.size(); i += 97) {
+            REQUIRE(versions[i].Size() == i);
+            REQUIRE(ToVector(versions[i]) == expected[i]);
+        }
+    }
+
+    SECTION("Set and PopBack") {
+        PersistentVector<std::string> vec;
+        for (int i = 0; i < 1100; ++i) {
+            vec = vec.PushBack(std::to_string(i));
+        }
+        auto changed = vec.Set(5, "five").Set(1099, "last");
+        REQUIRE(vec[5] == "5");
+        REQUIRE(changed[5] == "five");
+        REQUIRE(changed[1099] == "last");
+
+        auto popped = changed;
+        for (int i = 1099; i >= 0; --i) {
+            REQUIRE(popped.Size() == static_cast<size_t>(i) + 1);
+            REQUIRE(popped[i] == (i == 1099 ? "last" : i == 5 ? "five" : std::to_string(i)));
+            popped = popped.PopBack();
+        }
+        REQUIRE(popped.Empty());
+        REQUIRE(changed.Size() == 1100);
+        REQUIRE(vec[1099] == "1099");
+    }
+
+    SECTION("Random operations") {
+        std::mt19937 gen(7);
+        PersistentVector<int> vec;
+        std::vector<int> model;
+        for (int step = 0; step < 20000; ++step) {
+            int op = gen() % 4;
+            if (op == 0 && !model.empty()) {
+                vec = vec.PopBack();
+                model.pop_back();
+            } else if (op == 1 && !model.empty()) {
+                size_t index = gen() % model.size();
+                vec = vec.Set(index, step);
+                model[index] = step;
+            } else {
+                vec = vec.PushBack(step);
+                model.push_back(step);
+            }
+        }
+        REQUIRE(ToVector(vec) == model);
+    }
+
+    SECTION("Transient") {
+        PersistentVector<int> base;
+        for (int i = 0; i < 2000; ++i) {
+            base = base.PushBack(i);
+        }
+        auto builder = base.Transient();
+        for (int i = 0; i < 2000; i += 3) {
+            builder.Set(i, -i);
+        }
+        builder.PopBack();
+        builder.PushBack(42);
+        auto edited = builder.Persistent();
+        REQUIRE(builder.Size() == 0);
+        REQUIRE(base[3] == 3);
+        REQUIRE(base[1999] == 1999);
+        REQUIRE(edited[3] == -3);
+        REQUIRE(edited[1999] == 42);
+        REQUIRE(edited.Size() == 2000);
+    }
+
+    SECTION("Transient of a sole owner edits in place") {
+        PersistentVector<int> vec;
+        for (int i = 0; i < 2000; ++i) {
+            vec = vec.PushBack(i);
+        }
+        auto builder = std::move(vec).Transient();
+        EXPECT_ZERO_ALLOCATIONS(for (int i = 0; i < 2000; ++i) { builder.Set(i, i + 1); });
+        auto result = builder.Persistent();
+        REQUIRE(result[0] == 1);
+        REQUIRE(result[1999] == 2000);
+
+        // After a snapshot, the builder copies every node it touches once, then owns it.
+        auto snapshot = result;
+        auto again = std::move(result).Transient();
+        again.Set(0, 0);
+        EXPECT_ZERO_ALLOCATIONS(again.Set(1, 0));
+        REQUIRE(snapshot[0] == 1);
+        REQUIRE(again[0] == 0);
+    }
+}
+
+TEST_CASE("PersistentMap") {
+    SECTION("Versions stay intact") {
+        PersistentMap<int, std::string> empty;
+        auto one = empty.Set(1, "one");
+        auto two = one.Set(2, "two");
+        auto replaced = two.Set(1, "uno");
+        auto erased = replaced.Erase(2);
+        REQUIRE(empty.Size() == 0);
+        REQUIRE(*one.Find(1) == "one");
+        REQUIRE(two.Size() == 2);
+        REQUIRE(*replaced.Find(1) == "uno");
+        REQUIRE(*two.Find(1) == "one");
+        REQUIRE(!erased.Contains(2));
+        REQUIRE(two.Contains(2));
+        REQUIRE(erased.Erase(5).Size() == 1);
+    }
+
+    SECTION("Random operations") {
+        std::mt19937 gen(11);
+        PersistentMap<int, std::string> map;
+        std::map<int, std::string> model;
+        std::vector<std::pair<PersistentMap<int, std::string>, std::map<int, std::string>>>
+            snapshots;
+        for (int step = 0; step < 20000; ++step) {
+            int key = gen() % 2000;
+            if (gen() % 3 == 0) {
+                map = map.Erase(key);
+                model.erase(key);
+            } else {
+                map = map.Set(key, std::to_string(step));
+                model[key] = std::to_string(step);
+            }
+            if (step % 2000 == 0) {
+                snapshots.emplace_back(map, model);
+            }
+        }
+        REQUIRE(map.Size() == model.size());
+        REQUIRE(ToMap(map) == model);
+        for (const auto& [snapshot, expected] : snapshots) {
+            REQUIRE(ToMap(snapshot) == expected);
+        }
+    }
+
+    SECTION("Colliding hashes") {
+        PersistentMap<int, std::string, CollidingHash> map;
+        for (int i = 0; i < 30; ++i) {
+            map = map.Set(i, std::to_string(i));
+        }
+        REQUIRE(map.Size() == 30);
+        for (int i = 0; i < 30; i += 2) {
+            map = map.Erase(i);
+        }
+        REQUIRE(map.Size() == 15);
+        for (int i = 0; i < 30; ++i) {
+            REQUIRE(map.Contains(i) == (i % 2 == 1));
+        }
+        REQUIRE(*map.Find(7) == "7");
+    }
+
+    SECTION("Transient") {
+        PersistentMap<int, std::string> base;
+        for (int i = 0; i < 1000; ++i) {
+            base = base.Set(i, "v");
+        }
+        auto builder = base.Transient();
+        for (int i = 0; i < 1000; i += 2) {
+            builder.Erase(i);
+        }
+        builder.Set(5000, "new");
+        auto edited = builder.Persistent();
+        REQUIRE(base.Size() == 1000);
+        REQUIRE(edited.Size() == 501);
+        REQUIRE(base.Contains(2));
+        REQUIRE(!edited.Contains(2));
+        REQUIRE(*edited.Find(5000) == "new");
+
+        // Nodes still shared with base are copied on the first write, then edited in place.
+        auto again = std::move(edited).Transient();
+        again.Set(1, "y");
+        std::string value = "x";
+        EXPECT_ZERO_ALLOCATIONS(again.Set(1, value));
+        REQUIRE(*again.Find(1) == "x");
+    }
+}
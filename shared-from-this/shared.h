@@ -2,211 +2,769 @@
 
 #include "sw_fwd.h"
 
+#include <common/block_slab.h>
+#include <common/cache_line.h>
+#include <common/expiry_hook.h>
+#include <common/reclaim_queue.h>
+#include <common/relocatable.h>
+#include <unique/compressed_pair.h>
+
+#include <atomic>
 #include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <functional>
 #include <iostream>
+#include <memory>
+#include <new>
 
-struct BaseBlock {
+// Reference counting policies. A policy is picked per pointer type (SharedPtr<T, AtomicPolicy>)
+// and holds the control block counters. All strong references together hold one weak
+// reference, so both counts start at one. Decrements return the new value of the count.
+// TryStrongIncrement is the weak-to-strong upgrade: it fails once the strong count is zero,
+// because by then the object is being destroyed and must not come back.
 
-    virtual void StrongIncrement() = 0;
-    virtual void StrongDecrement() = 0;
-    virtual void WeakIncrement() = 0;
-    virtual void WeakDecrement() = 0;
-    virtual void WeakLightDecrement() = 0;
-    virtual bool IsObjExpired() = 0;
-    virtual size_t GetStrongCount() = 0;
-    virtual size_t GetWeakCount() = 0;
-    virtual ~BaseBlock(){};
+class SingleThreadPolicy {
+public:
+    void StrongIncrement() {
+        ++strong_cnt_;
+    }
+    bool TryStrongIncrement() {
+        if (strong_cnt_ == 0) {
+            return false;
+        }
+        ++strong_cnt_;
+        return true;
+    }
+    size_t StrongDecrement() {
+        return --strong_cnt_;
+    }
+    void WeakIncrement() {
+        ++weak_cnt_;
+    }
+    size_t WeakDecrement() {
+        return --weak_cnt_;
+    }
+    size_t StrongCount() const {
+        return strong_cnt_;
+    }
+    size_t WeakCount() const {
+        return weak_cnt_;
+    }
+
+private:
+    size_t strong_cnt_ = 1;
+    size_t weak_cnt_ = 1;
 };
 
-template <typename T>
-struct CBlockPtr : BaseBlock {
+// A new reference is always made from an existing one, so increments need no ordering.
+// Decrements release our writes to the object, and the thread that drops the last reference
+// acquires them all before running the destructor.
+class AtomicPolicy {
 public:
-    CBlockPtr() = default;
+    void StrongIncrement() {
+        strong_cnt_.fetch_add(1, std::memory_order_relaxed);
+    }
+    // A successful upgrade saw a non-zero count, so no destructor can be running: relaxed is
+    // enough here too.
+    bool TryStrongIncrement() {
+        size_t cur = strong_cnt_.load(std::memory_order_relaxed);
+        do {
+            if (cur == 0) {
+                return false;
+            }
+        } while (!strong_cnt_.compare_exchange_weak(cur, cur + 1, std::memory_order_relaxed));
+        return true;
+    }
+    size_t StrongDecrement() {
+        return strong_cnt_.fetch_sub(1, std::memory_order_acq_rel) - 1;
+    }
+    void WeakIncrement() {
+        weak_cnt_.fetch_add(1, std::memory_order_relaxed);
+    }
+    size_t WeakDecrement() {
+        return weak_cnt_.fetch_sub(1, std::memory_order_acq_rel) - 1;
+    }
+    size_t StrongCount() const {
+        return strong_cnt_.load(std::memory_order_acquire);
+    }
+    size_t WeakCount() const {
+        return weak_cnt_.load(std::memory_order_acquire);
+    }
+
+private:
+    std::atomic<size_t> strong_cnt_ = 1;
+    std::atomic<size_t> weak_cnt_ = 1;
+};
+
+// Compact layouts: both counts share one 64-bit word, strong in the low half and weak in the
+// high half, so a control block header is 16 bytes. Going past 2^32 - 1 references of either
+// kind calls std::terminate() instead of silently corrupting the other half.
+
+struct PackedWord {
+    static constexpr uint64_t kStrongOne = 1;
+    static constexpr uint64_t kWeakOne = uint64_t{1} << 32;
+    static constexpr uint64_t kHalfMask = 0xFFFFFFFF;
+    static constexpr uint64_t kInitial = kStrongOne | kWeakOne;
 
-    CBlockPtr(T* other) : strong_cnt(1), weak_cnt(0), obj(other), obj_is_expired(false){};
+    static size_t Strong(uint64_t word) {
+        return word & kHalfMask;
+    }
+    static size_t Weak(uint64_t word) {
+        return word >> 32;
+    }
+};
 
-    void StrongIncrement() override {
-        ++strong_cnt;
+class PackedPolicy {
+public:
+    void StrongIncrement() {
+        if (PackedWord::Strong(word_) == PackedWord::kHalfMask) {
+            std::terminate();
+        }
+        word_ += PackedWord::kStrongOne;
+    }
+    bool TryStrongIncrement() {
+        if (PackedWord::Strong(word_) == 0) {
+            return false;
+        }
+        StrongIncrement();
+        return true;
+    }
+    size_t StrongDecrement() {
+        word_ -= PackedWord::kStrongOne;
+        return PackedWord::Strong(word_);
+    }
+    void WeakIncrement() {
+        if (PackedWord::Weak(word_) == PackedWord::kHalfMask) {
+            std::terminate();
+        }
+        word_ += PackedWord::kWeakOne;
+    }
+    size_t WeakDecrement() {
+        word_ -= PackedWord::kWeakOne;
+        return PackedWord::Weak(word_);
+    }
+    size_t StrongCount() const {
+        return PackedWord::Strong(word_);
+    }
+    size_t WeakCount() const {
+        return PackedWord::Weak(word_);
     }
 
-    void StrongDecrement() override {
-        --strong_cnt;
-        if (strong_cnt == 0) {
-            TryDeleteObj();
-            TryDeleteThis();
+private:
+    uint64_t word_ = PackedWord::kInitial;
+};
+
+class PackedAtomicPolicy {
+public:
+    void StrongIncrement() {
+        uint64_t old = word_.fetch_add(PackedWord::kStrongOne, std::memory_order_relaxed);
+        if (PackedWord::Strong(old) == PackedWord::kHalfMask) {
+            std::terminate();
         }
     }
+    bool TryStrongIncrement() {
+        uint64_t cur = word_.load(std::memory_order_relaxed);
+        do {
+            if (PackedWord::Strong(cur) == 0) {
+                return false;
+            }
+            if (PackedWord::Strong(cur) == PackedWord::kHalfMask) {
+                std::terminate();
+            }
+        } while (!word_.compare_exchange_weak(cur, cur + PackedWord::kStrongOne,
+                                              std::memory_order_relaxed));
+        return true;
+    }
+    size_t StrongDecrement() {
+        uint64_t old = word_.fetch_sub(PackedWord::kStrongOne, std::memory_order_acq_rel);
+        return PackedWord::Strong(old) - 1;
+    }
+    void WeakIncrement() {
+        uint64_t old = word_.fetch_add(PackedWord::kWeakOne, std::memory_order_relaxed);
+        if (PackedWord::Weak(old) == PackedWord::kHalfMask) {
+            std::terminate();
+        }
+    }
+    size_t WeakDecrement() {
+        uint64_t old = word_.fetch_sub(PackedWord::kWeakOne, std::memory_order_acq_rel);
+        return PackedWord::Weak(old) - 1;
+    }
+    size_t StrongCount() const {
+        return PackedWord::Strong(word_.load(std::memory_order_acquire));
+    }
+    size_t WeakCount() const {
+        return PackedWord::Weak(word_.load(std::memory_order_acquire));
+    }
 
-    void WeakIncrement() override {
-        ++weak_cnt;
+private:
+    std::atomic<uint64_t> word_ = PackedWord::kInitial;
+};
+
+// Where control blocks come from: plain new and delete unless the policy says otherwise.
+template <typename Policy>
+struct BlockAllocator {
+    static void* Allocate(size_t size) {
+        return ::operator new(size);
+    }
+    static void Deallocate(void* ptr, size_t size) {
+        ::operator delete(ptr, size);
+    }
+};
+
+// SharedPtr<T, SlabPolicy<AtomicPolicy>> counts like AtomicPolicy and takes its control blocks
+// from BlockSlab: after warmup, creating and dropping pointers does not call malloc.
+// BiasedPolicy cannot be wrapped.
+template <typename Counting = SingleThreadPolicy>
+class SlabPolicy : public Counting {};
+
+template <typename Counting>
+struct BlockAllocator<SlabPolicy<Counting>> {
+    static void* Allocate(size_t size) {
+        return BlockSlab::Allocate(size);
+    }
+    static void Deallocate(void* ptr, size_t size) {
+        BlockSlab::Deallocate(ptr, size);
     }
+    static void Reserve(size_t size, size_t n) {
+        BlockSlab::Reserve(size, n);
+    }
+};
+
+// SharedPtr<T, DeferredPolicy<AtomicPolicy>> counts like AtomicPolicy, but the last release
+// only queues the object; DrainReclaimQueue() destroys it later (see reclaim_queue.h). Until
+// then weak pointers already see it expired. Combines with SlabPolicy as
+// SlabPolicy<DeferredPolicy<...>>; BiasedPolicy cannot be wrapped.
+struct DeferredDispose {
+    ReclaimNode reclaim_node;
+};
 
-    void WeakDecrement() override {
-        --weak_cnt;
-        if (weak_cnt == 0 && strong_cnt == 0) {
-            delete this;
+template <typename Counting = AtomicPolicy>
+class DeferredPolicy : public Counting, public DeferredDispose {};
+
+// SharedPtr<T, ObservablePolicy<AtomicPolicy>> counts like AtomicPolicy, and its OnExpire
+// links ExpiryHooks that are called back when the object dies (see expiry_hook.h). Wraps and
+// is wrapped by SlabPolicy and DeferredPolicy; BiasedPolicy cannot be wrapped.
+template <typename Counting = AtomicPolicy>
+class ObservablePolicy : public Counting, public ExpiryList {};
+
+enum class BlockOp { kDisposeObj, kDestroyBlock };
+
+// Counters live here and are updated inline. The only indirect call left is `hook`: it runs
+// once when the object dies and once when the block is freed, and is instantiated per T only.
+// The block is freed exactly once: by whoever drops the last weak reference, after the object
+// is already gone.
+template <typename Policy>
+struct BaseBlock {
+    using Hook = void (*)(BaseBlock*, BlockOp);
+
+    explicit BaseBlock(Hook hook) : hook(hook){};
+
+    // `delete self` in a hook passes the size of the concrete block.
+    static void* operator new(size_t size) {
+        return BlockAllocator<Policy>::Allocate(size);
+    }
+    static void operator delete(void* ptr, size_t size) {
+        BlockAllocator<Policy>::Deallocate(ptr, size);
+    }
+    static void* operator new(size_t size, std::align_val_t align) {
+        return ::operator new(size, align);
+    }
+    static void operator delete(void* ptr, size_t size, std::align_val_t align) {
+        ::operator delete(ptr, size, align);
+    }
+    static void* operator new(size_t, void* where) {
+        return where;
+    }
+
+    void StrongIncrement() {
+        cnt.StrongIncrement();
+    }
+
+    bool TryStrongIncrement() {
+        return cnt.TryStrongIncrement();
+    }
+
+    void StrongDecrement() {
+        if (cnt.StrongDecrement() == 0) {
+            if constexpr (std::is_base_of_v<DeferredDispose, Policy>) {
+                cnt.reclaim_node.reclaim = &BaseBlock::Dispose;
+                cnt.reclaim_node.object = this;
+                ReclaimQueue::Push(&cnt.reclaim_node);
+            } else {
+                Dispose(this);
+            }
         }
     }
 
-    bool IsObjExpired() override {
-        return obj_is_expired;
+    static void Dispose(void* self) {
+        auto block = static_cast<BaseBlock*>(self);
+        block->hook(block, BlockOp::kDisposeObj);
+        if constexpr (std::is_base_of_v<ExpiryList, Policy>) {
+            block->cnt.Fire();
+        }
+        block->WeakDecrement();
     }
 
-    size_t GetStrongCount() override {
-        return strong_cnt;
+    // The hook keeps a weak reference until it is unlinked.
+    bool LinkExpiryHook(ExpiryHook* hook) {
+        hook->Unlink();
+        WeakIncrement();
+        if (!cnt.Link(hook, this, &BaseBlock::ReleaseWeak)) {
+            WeakDecrement();
+            return false;
+        }
+        return true;
     }
 
-    size_t GetWeakCount() override {
-        return strong_cnt;
+    static void ReleaseWeak(void* self) {
+        static_cast<BaseBlock*>(self)->WeakDecrement();
     }
 
-    void WeakLightDecrement() override {
-        --weak_cnt;
+    void WeakIncrement() {
+        cnt.WeakIncrement();
     }
 
-    void TryDeleteObj() {
-        if (!obj_is_expired) {
-            delete obj;
-            obj = nullptr;
-            obj_is_expired = true;
+    void WeakDecrement() {
+        if (cnt.WeakDecrement() == 0) {
+            hook(this, BlockOp::kDestroyBlock);
         }
     }
 
-    void TryDeleteThis() {
-        if (weak_cnt == 0) {
-            delete this;
+    void WeakLightDecrement() {
+        cnt.WeakDecrement();
+    }
+
+    bool IsObjExpired() const {
+        return cnt.StrongCount() == 0;
+    }
+
+    size_t GetStrongCount() const {
+        return cnt.StrongCount();
+    }
+
+    size_t GetWeakCount() const {
+        return cnt.WeakCount() - (IsObjExpired() ? 0 : 1);
+    }
+
+    Policy cnt;
+    Hook hook;
+};
+
+template <typename T, typename Policy>
+struct CBlockPtr : BaseBlock<Policy> {
+public:
+    CBlockPtr(std::remove_extent_t<T>* other) : BaseBlock<Policy>(&CBlockPtr::Hook), obj(other){};
+
+    static void Hook(BaseBlock<Policy>* base, BlockOp op) {
+        auto self = static_cast<CBlockPtr*>(base);
+        if (op == BlockOp::kDisposeObj) {
+            if constexpr (std::is_array_v<T>) {
+                delete[] self->obj;
+            } else {
+                delete self->obj;
+            }
+            self->obj = nullptr;
+        } else {
+            delete self;
         }
     }
 
-    ~CBlockPtr(){};
+    std::remove_extent_t<T>* obj;
+};
+
+// SharedPtr(ptr, deleter). The pointer and the deleter share a CompressedPair, so a stateless
+// deleter makes the block no bigger than CBlockPtr.
+template <typename T, typename Policy, typename Deleter>
+struct CBlockDeleter : BaseBlock<Policy> {
+public:
+    CBlockDeleter(T* obj, Deleter&& deleter)
+        : BaseBlock<Policy>(&CBlockDeleter::Hook), cp(obj, std::move(deleter)){};
+
+    static void Hook(BaseBlock<Policy>* base, BlockOp op) {
+        auto self = static_cast<CBlockDeleter*>(base);
+        if (op == BlockOp::kDisposeObj) {
+            self->cp.GetSecond()(self->cp.GetFirst());
+        } else {
+            delete self;
+        }
+    }
 
-    size_t strong_cnt;
-    size_t weak_cnt;
-    bool obj_is_expired;
-    T* obj;
+    CompressedPair<T*, Deleter> cp;
 };
 
-template <typename T, typename... Args>
-struct CBlockObj : BaseBlock {
+struct DefaultInitTag {};
+
+template <typename T, typename Policy>
+struct CBlockObj : BaseBlock<Policy> {
 public:
-    CBlockObj(Args&&... args) : strong_cnt(1), weak_cnt(0), obj_is_expired(false) {
+    template <typename... Args>
+    CBlockObj(Args&&... args) : BaseBlock<Policy>(&CBlockObj::Hook) {
         new (&buffer) T(std::forward<Args>(args)...);
     };
 
-    void StrongIncrement() override {
-        ++strong_cnt;
-    }
+    // MakeSharedForOverwrite: leaves trivial types uninitialized.
+    CBlockObj(DefaultInitTag) : BaseBlock<Policy>(&CBlockObj::Hook) {
+        new (&buffer) T;
+    };
 
-    void StrongDecrement() override {
-        --strong_cnt;
-        if (strong_cnt == 0) {
-            TryDeleteObj();
-            TryDeleteThis();
+    static void Hook(BaseBlock<Policy>* base, BlockOp op) {
+        auto self = static_cast<CBlockObj*>(base);
+        if (op == BlockOp::kDisposeObj) {
+            reinterpret_cast<T*>(&self->buffer)->~T();
+        } else {
+            delete self;
         }
     }
 
-    void WeakIncrement() override {
-        ++weak_cnt;
+    std::aligned_storage_t<sizeof(T), alignof(T)> buffer;
+};
+
+// MakeSharedIsolated: like CBlockObj, but the object starts on a cache line of its own, so
+// reference count updates do not evict it from the caches of the cores that read it.
+template <typename T, typename Policy>
+struct CBlockIsolated : BaseBlock<Policy> {
+public:
+    template <typename... Args>
+    CBlockIsolated(Args&&... args) : BaseBlock<Policy>(&CBlockIsolated::Hook) {
+        new (&buffer) T(std::forward<Args>(args)...);
+    };
+
+    static void Hook(BaseBlock<Policy>* base, BlockOp op) {
+        auto self = static_cast<CBlockIsolated*>(base);
+        if (op == BlockOp::kDisposeObj) {
+            reinterpret_cast<T*>(&self->buffer)->~T();
+        } else {
+            delete self;
+        }
     }
 
-    void WeakDecrement() override {
-        --weak_cnt;
-        if (strong_cnt == 0 && weak_cnt == 0) {
-            delete this;
+    alignas(kCacheLineSize) std::aligned_storage_t<sizeof(T), alignof(T)> buffer;
+};
+
+// MakeShared<T[]>(n): the header, the element count and the elements share one allocation,
+// with the elements right after the header.
+template <typename T, typename Policy>
+struct CBlockArray : BaseBlock<Policy> {
+public:
+    using ElementType = std::remove_extent_t<T>;
+
+    static_assert(!std::is_array_v<ElementType>, "Multidimensional arrays are not supported");
+
+    static CBlockArray* Create(size_t size, bool for_overwrite) {
+        auto block = new (Allocate(size)) CBlockArray(size);
+        ElementType* elements = block->Elements();
+        size_t i = 0;
+        try {
+            for (; i < size; ++i) {
+                if (for_overwrite) {
+                    new (elements + i) ElementType;
+                } else {
+                    new (elements + i) ElementType();
+                }
+            }
+        } catch (...) {
+            for (; i > 0; --i) {
+                std::destroy_at(elements + i - 1);
+            }
+            Hook(block, BlockOp::kDestroyBlock);
+            throw;
         }
+        return block;
     }
 
-    void WeakLightDecrement() override {
-        --weak_cnt;
+    ElementType* Elements() {
+        return reinterpret_cast<ElementType*>(reinterpret_cast<char*>(this) + Offset());
     }
 
-    bool IsObjExpired() {
-        return obj_is_expired;
+    static void Hook(BaseBlock<Policy>* base, BlockOp op) {
+        auto self = static_cast<CBlockArray*>(base);
+        if (op == BlockOp::kDisposeObj) {
+            for (size_t i = self->size; i > 0; --i) {
+                std::destroy_at(self->Elements() + i - 1);
+            }
+        } else {
+            size_t bytes = Offset() + self->size * sizeof(ElementType);
+            self->~CBlockArray();
+            if constexpr (kOverAligned) {
+                ::operator delete(self, std::align_val_t(alignof(ElementType)));
+            } else {
+                BlockAllocator<Policy>::Deallocate(self, bytes);
+            }
+        }
     }
 
-    size_t GetStrongCount() override {
-        return strong_cnt;
+    size_t size;
+
+private:
+    static constexpr bool kOverAligned = alignof(ElementType) > __STDCPP_DEFAULT_NEW_ALIGNMENT__;
+
+    explicit CBlockArray(size_t size) : BaseBlock<Policy>(&CBlockArray::Hook), size(size){};
+
+    static size_t Offset() {
+        return (sizeof(CBlockArray) + alignof(ElementType) - 1) / alignof(ElementType) *
+               alignof(ElementType);
     }
 
-    size_t GetWeakCount() override {
-        return strong_cnt;
+    static void* Allocate(size_t size) {
+        size_t bytes = Offset() + size * sizeof(ElementType);
+        if constexpr (kOverAligned) {
+            return ::operator new(bytes, std::align_val_t(alignof(ElementType)));
+        } else {
+            return BlockAllocator<Policy>::Allocate(bytes);
+        }
     }
+};
+
+// The element count of MakeShared<T[]>(n) and MakeShared<T[N]>().
+template <typename T>
+size_t ArraySize() {
+    static_assert(std::extent_v<T> != 0, "MakeShared<T[]> needs the number of elements");
+    return std::extent_v<T>;
+}
+
+template <typename T>
+size_t ArraySize(size_t size) {
+    static_assert(std::extent_v<T> == 0, "MakeShared<T[N]> takes no arguments");
+    return size;
+}
 
-    void TryDeleteObj() {
-        obj_is_expired = true;
-        reinterpret_cast<T*>(&buffer)->~T();
+// CBlockObj allocated through Alloc. The allocator is kept in the block, and takes no space
+// when it is empty.
+template <typename T, typename Policy, typename Alloc>
+struct CBlockAllocObj : BaseBlock<Policy> {
+public:
+    using ObjTraits =
+        typename std::allocator_traits<Alloc>::template rebind_traits<std::remove_cv_t<T>>;
+    using BlockAlloc = typename std::allocator_traits<Alloc>::template rebind_alloc<CBlockAllocObj>;
+
+    explicit CBlockAllocObj(const Alloc& alloc)
+        : BaseBlock<Policy>(&CBlockAllocObj::Hook), cp(RawStorage<T>(), Alloc(alloc)){};
+
+    T* Obj() {
+        return cp.GetFirst().Get();
     }
 
-    void TryDeleteThis() {
-        if (weak_cnt == 0) {
-            delete this;
+    static void Hook(BaseBlock<Policy>* base, BlockOp op) {
+        auto self = static_cast<CBlockAllocObj*>(base);
+        if (op == BlockOp::kDisposeObj) {
+            typename ObjTraits::allocator_type alloc(self->cp.GetSecond());
+            ObjTraits::destroy(alloc, const_cast<std::remove_cv_t<T>*>(self->Obj()));
+        } else {
+            BlockAlloc alloc(self->cp.GetSecond());
+            self->~CBlockAllocObj();
+            std::allocator_traits<BlockAlloc>::deallocate(alloc, self, 1);
         }
     }
 
-    ~CBlockObj(){};
-
-    size_t strong_cnt;
-    size_t weak_cnt;
-    bool obj_is_expired;
-    std::aligned_storage_t<sizeof(T), alignof(T)> buffer;
+    CompressedPair<RawStorage<T>, Alloc> cp;
 };
 
 class ESFTBase {};
 
-template <typename T>
+template <typename T, typename Policy = SingleThreadPolicy>
 class EnableSharedFromThis : public ESFTBase {
 public:
-    SharedPtr<T> SharedFromThis() {
+    SharedPtr<T, Policy> SharedFromThis() {
         return weak_this_.Lock();
     }
-    SharedPtr<const T> SharedFromThis() const {
+    SharedPtr<const T, Policy> SharedFromThis() const {
         return weak_this_.Lock();
     };
 
-    WeakPtr<T> WeakFromThis() noexcept {
+    WeakPtr<T, Policy> WeakFromThis() noexcept {
         return weak_this_;
     };
-    WeakPtr<const T> WeakFromThis() const noexcept {
-        return WeakPtr<const T>(weak_this_);
+    WeakPtr<const T, Policy> WeakFromThis() const noexcept {
+        return WeakPtr<const T, Policy>(weak_this_);
     };
 
     ~EnableSharedFromThis() {
         weak_this_.SafeWeakLightDecrement();
         weak_this_.PrettyReset();
     };
-    WeakPtr<T> weak_this_;
+    WeakPtr<T, Policy> weak_this_;
 
 private:
-    template <typename U>
+    template <typename U, typename P>
     friend class WeakPtr;
-    template <typename U>
+    template <typename U, typename P>
     friend class SharedPtr;
 };
 
-template <typename T>
+template <typename T, typename Policy>
+class InlineSharedFromThis;
+
+// The control block of an InlineSharedFromThis object, kept inside the object itself. It has no
+// hook until a SharedPtr adopts the object. Disposing runs the destructor only: the counters
+// live on in the object's storage, which is freed when the last WeakPtr goes away.
+template <typename T, typename Policy>
+struct CBlockInline : BaseBlock<Policy> {
+    // The block is made while T is not constructed yet, so it keeps the base and casts later.
+    explicit CBlockInline(InlineSharedFromThis<T, Policy>* owner)
+        : BaseBlock<Policy>(nullptr), owner(owner){};
+
+    void Adopt() {
+        this->hook = &CBlockInline::Hook;
+    }
+
+    static void Hook(BaseBlock<Policy>* base, BlockOp op) {
+        auto self = static_cast<CBlockInline*>(base);
+        if (op == BlockOp::kDisposeObj) {
+            T* obj = static_cast<T*>(self->owner);
+            void* storage = obj;
+            if constexpr (std::is_polymorphic_v<T>) {
+                storage = dynamic_cast<void*>(obj);
+            }
+            obj->~T();
+            self->storage = storage;
+            return;
+        }
+        void* storage = self->storage;
+        self->~CBlockInline();
+        if constexpr (alignof(T) > __STDCPP_DEFAULT_NEW_ALIGNMENT__) {
+            ::operator delete(storage, std::align_val_t(alignof(T)));
+        } else {
+            ::operator delete(storage);
+        }
+    }
+
+    union {
+        InlineSharedFromThis<T, Policy>* owner;
+        void* storage;  // Once the object is destroyed.
+    };
+};
+
+class InlineBlockBase {};
+
+// Like EnableSharedFromThis, but the object carries its control block instead of a WeakPtr to
+// a separate one: SharedPtr<T>(new T) and MakeShared<T> allocate only the object, and
+// SharedFromThis is a single increment. The object must come from a plain `new T` (its
+// storage is released with ::operator delete) and can be adopted only by SharedPtr(ptr) or
+// MakeShared. Before that, SharedFromThis and WeakFromThis return empty pointers. The object
+// is destroyed as a T, so adopting an object of a class derived from T needs a virtual ~T.
+template <typename T, typename Policy = SingleThreadPolicy>
+class InlineSharedFromThis : public InlineBlockBase {
+public:
+    InlineSharedFromThis() {
+        new (block_.Get()) CBlockInline<T, Policy>(this);
+    }
+
+    // A copy is a different object with a control block of its own.
+    InlineSharedFromThis(const InlineSharedFromThis&) : InlineSharedFromThis() {
+    }
+    InlineSharedFromThis& operator=(const InlineSharedFromThis&) {
+        return *this;
+    }
+
+    // Once adopted, the block outlives the object and its hook destroys it.
+    ~InlineSharedFromThis() {
+        if (block_.Get()->hook == nullptr) {
+            block_.Get()->~CBlockInline();
+        }
+    }
+
+    SharedPtr<T, Policy> SharedFromThis() {
+        return Share<T>();
+    }
+    SharedPtr<const T, Policy> SharedFromThis() const {
+        return Share<const T>();
+    }
+
+    WeakPtr<T, Policy> WeakFromThis() noexcept {
+        return Watch<T>();
+    }
+    WeakPtr<const T, Policy> WeakFromThis() const noexcept {
+        return Watch<const T>();
+    }
+
+private:
+    template <typename U, typename P>
+    friend class SharedPtr;
+
+    BaseBlock<Policy>* Block() const {
+        return block_.Get();
+    }
+
+    // Fails once the object is being destroyed, so a destructor cannot resurrect it.
+    template <typename U>
+    SharedPtr<U, Policy> Share() const {
+        SharedPtr<U, Policy> sp;
+        BaseBlock<Policy>* block = Block();
+        if (block->hook != nullptr && block->TryStrongIncrement()) {
+            sp.ptr_ = static_cast<U*>(const_cast<InlineSharedFromThis*>(this));
+            sp.block_ = block;
+        }
+        return sp;
+    }
+
+    template <typename U>
+    WeakPtr<U, Policy> Watch() const noexcept {
+        WeakPtr<U, Policy> wp;
+        BaseBlock<Policy>* block = Block();
+        if (block->hook != nullptr) {
+            wp.ptr_ = static_cast<U*>(const_cast<InlineSharedFromThis*>(this));
+            wp.block_ = block;
+            block->WeakIncrement();
+        }
+        return wp;
+    }
+
+    mutable RawStorage<CBlockInline<T, Policy>> block_;
+};
+
+template <typename T, typename Policy>
 class SharedPtr {
 public:
+    // T for single objects; SharedPtr<T[]> points to the first element.
+    using ElementType = std::remove_extent_t<T>;
+
     SharedPtr() : ptr_(nullptr), block_(nullptr){};
 
     SharedPtr(std::nullptr_t) : ptr_(nullptr), block_(nullptr){};
 
-    explicit SharedPtr(T* ptr) : ptr_(ptr) {
-        block_ = new CBlockPtr(ptr_);
-        if constexpr (std::is_convertible_v<T*, ESFTBase*>) {
-            InitWeakThis(ptr);
+    explicit SharedPtr(ElementType* ptr) : ptr_(ptr) {
+        if constexpr (std::is_convertible_v<T*, InlineBlockBase*>) {
+            block_ = AdoptInline(ptr, ptr);
+        } else {
+            block_ = new CBlockPtr<T, Policy>(ptr_);
+            if constexpr (std::is_convertible_v<T*, ESFTBase*>) {
+                InitWeakThis(ptr);
+            }
         }
     }
 
     template <typename U>
     explicit SharedPtr(U* ptr) : ptr_(ptr) {
-        block_ = new CBlockPtr(ptr);
+        if constexpr (std::is_convertible_v<U*, InlineBlockBase*>) {
+            block_ = AdoptInline(ptr, ptr);
+        } else {
+            block_ = new CBlockPtr<U, Policy>(ptr);
+            if constexpr (std::is_convertible_v<U*, ESFTBase*>) {
+                InitWeakThis(ptr);
+            }
+        }
+    }
+
+    // The deleter is called with ptr once the last SharedPtr is gone, or right away if the
+    // control block cannot be allocated.
+    template <typename U, typename Deleter>
+    SharedPtr(U* ptr, Deleter deleter) : ptr_(ptr) {
+        static_assert(!std::is_convertible_v<U*, InlineBlockBase*>,
+                      "InlineSharedFromThis objects always use their own control block");
+        try {
+            block_ = new CBlockDeleter<U, Policy, Deleter>(ptr, std::move(deleter));
+        } catch (...) {
+            deleter(ptr);
+            throw;
+        }
         if constexpr (std::is_convertible_v<U*, ESFTBase*>) {
             InitWeakThis(ptr);
         }
     }
 
     template <typename U>
-    SharedPtr(const SharedPtr<U>& other) : ptr_(other.ptr_), block_(other.block_) {
+    SharedPtr(const SharedPtr<U, Policy>& other) : ptr_(other.ptr_), block_(other.block_) {
         SafeIncrement();
     }
 
@@ -214,42 +772,50 @@ public:
         SafeIncrement();
     }
 
+    // Moves hand the reference over and never touch the counters.
     template <typename U>
-    SharedPtr(SharedPtr<U>&& other) {
-        ptr_ = other.ptr_;
-        block_ = other.block_;
-        SafeIncrement();
-        other.Reset();
+    SharedPtr(SharedPtr<U, Policy>&& other) noexcept : ptr_(other.ptr_), block_(other.block_) {
+        other.ptr_ = nullptr;
+        other.block_ = nullptr;
     }
 
-    SharedPtr(SharedPtr&& other) {
-        ptr_ = other.ptr_;
-        block_ = other.block_;
-        SafeIncrement();
-        other.Reset();
+    SharedPtr(SharedPtr&& other) noexcept : ptr_(other.ptr_), block_(other.block_) {
+        other.ptr_ = nullptr;
+        other.block_ = nullptr;
     }
 
     template <typename Y>
-    SharedPtr(const SharedPtr<Y>& other, T* ptr) : ptr_(ptr), block_(other.block_) {
+    SharedPtr(const SharedPtr<Y, Policy>& other, ElementType* ptr)
+        : ptr_(ptr), block_(other.block_) {
         SafeIncrement();
     }
 
-    explicit SharedPtr(const WeakPtr<T>& other) {
-        if (other.Expired()) {
+    explicit SharedPtr(const WeakPtr<T, Policy>& other) : ptr_(other.ptr_), block_(other.block_) {
+        if (ptr_ == nullptr || block_ == nullptr || !block_->TryStrongIncrement()) {
             throw BadWeakPtr();
         }
-        ptr_ = other.ptr_;
-        block_ = other.block_;
-        SafeIncrement();
     };
 
     template <typename Y>
-    void InitWeakThis(EnableSharedFromThis<Y>* e) {
+    void InitWeakThis(EnableSharedFromThis<Y, Policy>* e) {
         e->weak_this_ = *this;
     }
 
+    // The counters in the object already hold this reference.
+    template <typename U, typename Y>
+    static BaseBlock<Policy>* AdoptInline(U*, InlineSharedFromThis<Y, Policy>* e) {
+        static_assert(std::is_same_v<std::remove_cv_t<U>, Y> || std::has_virtual_destructor_v<Y>,
+                      "An InlineSharedFromThis<Y> object is destroyed as a Y: ~Y must be virtual");
+        if (e == nullptr) {
+            return nullptr;
+        }
+        auto block = static_cast<CBlockInline<Y, Policy>*>(e->Block());
+        block->Adopt();
+        return block;
+    }
+
     template <typename U>
-    SharedPtr& operator=(const SharedPtr<U>& other) {
+    SharedPtr& operator=(const SharedPtr<U, Policy>& other) {
         SafeDecrement();
         ptr_ = other.ptr_;
         block_ = other.block_;
@@ -265,21 +831,13 @@ public:
     }
 
     template <typename U>
-    SharedPtr& operator=(SharedPtr<U>&& other) {
-        SafeDecrement();
-        ptr_ = other.ptr_;
-        block_ = other.block_;
-        SafeIncrement();
-        other.Reset();
+    SharedPtr& operator=(SharedPtr<U, Policy>&& other) noexcept {
+        SharedPtr(std::move(other)).Swap(*this);
         return *this;
     }
 
-    SharedPtr& operator=(SharedPtr&& other) {
-        SafeDecrement();
-        ptr_ = other.ptr_;
-        block_ = other.block_;
-        SafeIncrement();
-        other.Reset();
+    SharedPtr& operator=(SharedPtr&& other) noexcept {
+        SharedPtr(std::move(other)).Swap(*this);
         return *this;
     }
 
@@ -293,20 +851,22 @@ public:
         block_ = nullptr;
     }
 
-    void Reset(T* ptr) {
-        SafeDecrement();
-        ptr_ = ptr;
-        block_ = new CBlockPtr(ptr);
+    // Same block choice as the constructors: inline counters, or a new block and weak_this_.
+    void Reset(ElementType* ptr) {
+        SharedPtr(ptr).Swap(*this);
     }
 
     template <typename U>
     void Reset(U* ptr) {
-        SafeDecrement();
-        ptr_ = ptr;
-        block_ = new CBlockPtr(ptr);
+        SharedPtr(ptr).Swap(*this);
     };
 
-    void Swap(SharedPtr& other) {
+    template <typename U, typename Deleter>
+    void Reset(U* ptr, Deleter deleter) {
+        SharedPtr(ptr, std::move(deleter)).Swap(*this);
+    };
+
+    void Swap(SharedPtr& other) noexcept {
         std::swap(ptr_, other.ptr_);
         std::swap(block_, other.block_);
     };
@@ -323,19 +883,20 @@ public:
         }
     }
 
-    T* Get() const {
-        if (block_ != nullptr && block_->IsObjExpired()) {
-            return nullptr;
-        }
+    ElementType* Get() const {
         return ptr_;
     }
 
-    std::add_lvalue_reference_t<T> operator*() const {
+    std::add_lvalue_reference_t<ElementType> operator*() const {
         return *ptr_;
     }
-    T* operator->() const {
+    ElementType* operator->() const {
         return ptr_;
     }
+    std::add_lvalue_reference_t<ElementType> operator[](std::ptrdiff_t i) const {
+        static_assert(std::is_array_v<T>, "operator[] is only for SharedPtr<T[]>");
+        return ptr_[i];
+    }
     size_t UseCount() const {
         if (block_ == nullptr) {
             return 0;
@@ -347,29 +908,149 @@ public:
         return ptr_ != nullptr;
     };
 
+    // Ownership-based comparisons, like std::owner_less: pointers that share a control block
+    // are equivalent whatever they point to, and a WeakPtr keeps its place after expiring.
+    template <typename Other>
+    bool OwnerBefore(const Other& other) const {
+        return std::less<const void*>()(block_, other.block_);
+    }
+    template <typename Other>
+    bool OwnerEqual(const Other& other) const {
+        return static_cast<const void*>(block_) == other.block_;
+    }
+    size_t OwnerHash() const {
+        return std::hash<const void*>()(block_);
+    }
+
+    // ObservablePolicy only: hook's callback runs once the object is destroyed. Returns false,
+    // leaving the hook unlinked, if the object has expired already.
+    bool OnExpire(ExpiryHook* hook) const {
+        static_assert(std::is_base_of_v<ExpiryList, Policy>, "OnExpire needs ObservablePolicy");
+        return block_ != nullptr && block_->LinkExpiryHook(hook);
+    }
+
 private:
-    T* ptr_;
-    BaseBlock* block_;
+    ElementType* ptr_;
+    BaseBlock<Policy>* block_;
 
-    template <typename U>
+    template <typename U, typename P>
     friend class SharedPtr;
 
-    template <typename U>
+    template <typename U, typename P>
     friend class WeakPtr;
 
-    template <typename U, typename... Args>
-    friend SharedPtr<U> MakeShared(Args&&... args);
+    template <typename U, typename P, typename... Args>
+    friend SharedPtr<U, P> MakeShared(Args&&... args);
+
+    template <typename U, typename P, typename... Args>
+    friend SharedPtr<U, P> MakeSharedForOverwrite(Args... size);
+
+    template <typename U, typename P, typename... Args>
+    friend SharedPtr<U, P> MakeSharedIsolated(Args&&... args);
+
+    template <typename U, typename P, typename A, typename... Args>
+    friend SharedPtr<U, P> AllocateShared(const A& alloc, Args&&... args);
+
+    template <typename Handle>
+    friend class AtomicSlot;
+
+    template <typename U, typename P>
+    friend class InlineSharedFromThis;
+
+    template <typename U, typename P>
+    friend class ThinSharedPtr;
+
+    template <typename U, typename P>
+    friend class CompressedSharedPtr;
 };
 
-template <typename T, typename U>
-inline bool operator==(const SharedPtr<T>& left, const SharedPtr<U>& right) {
+template <typename T, typename Policy>
+struct IsTriviallyRelocatable<SharedPtr<T, Policy>> : std::true_type {};
+
+template <typename T, typename U, typename Policy>
+inline bool operator==(const SharedPtr<T, Policy>& left, const SharedPtr<U, Policy>& right) {
     return left.Get() == right.Get();
 };
 
-template <typename T, typename... Args>
-SharedPtr<T> MakeShared(Args&&... args) {
-    SharedPtr<T> sp;
-    auto block = new CBlockObj<T, Args...>(std::forward<Args>(args)...);
+// Functors for containers keyed by SharedPtr or WeakPtr ownership, in any mix.
+struct OwnerLess {
+    using is_transparent = void;
+
+    template <typename Left, typename Right>
+    bool operator()(const Left& left, const Right& right) const {
+        return left.OwnerBefore(right);
+    }
+};
+
+struct OwnerEqual {
+    using is_transparent = void;
+
+    template <typename Left, typename Right>
+    bool operator()(const Left& left, const Right& right) const {
+        return left.OwnerEqual(right);
+    }
+};
+
+struct OwnerHash {
+    using is_transparent = void;
+
+    template <typename Ptr>
+    size_t operator()(const Ptr& ptr) const {
+        return ptr.OwnerHash();
+    }
+};
+
+template <typename T, typename Policy, typename... Args>
+SharedPtr<T, Policy> MakeShared(Args&&... args) {
+    SharedPtr<T, Policy> sp;
+    if constexpr (std::is_array_v<T>) {
+        auto block = CBlockArray<T, Policy>::Create(ArraySize<T>(args...), false);
+        sp.ptr_ = block->Elements();
+        sp.block_ = block;
+    } else if constexpr (std::is_convertible_v<T*, InlineBlockBase*>) {
+        return SharedPtr<T, Policy>(new T(std::forward<Args>(args)...));
+    } else {
+        auto block = new CBlockObj<T, Policy>(std::forward<Args>(args)...);
+        sp.ptr_ = reinterpret_cast<T*>(&(block->buffer));
+        sp.block_ = block;
+        if constexpr (std::is_convertible_v<T*, ESFTBase*>) {
+            sp.InitWeakThis(sp.ptr_);
+        }
+    }
+    return sp;
+}
+
+// Like MakeShared, but default-initializes: trivial types, and arrays of them, are left as is.
+template <typename T, typename Policy, typename... Args>
+SharedPtr<T, Policy> MakeSharedForOverwrite(Args... size) {
+    SharedPtr<T, Policy> sp;
+    if constexpr (std::is_array_v<T>) {
+        auto block = CBlockArray<T, Policy>::Create(ArraySize<T>(size...), true);
+        sp.ptr_ = block->Elements();
+        sp.block_ = block;
+    } else if constexpr (std::is_convertible_v<T*, InlineBlockBase*>) {
+        return SharedPtr<T, Policy>(new T);
+    } else {
+        static_assert(sizeof...(Args) == 0, "MakeSharedForOverwrite<T> takes no arguments");
+        auto block = new CBlockObj<T, Policy>(DefaultInitTag());
+        sp.ptr_ = reinterpret_cast<T*>(&(block->buffer));
+        sp.block_ = block;
+        if constexpr (std::is_convertible_v<T*, ESFTBase*>) {
+            sp.InitWeakThis(sp.ptr_);
+        }
+    }
+    return sp;
+}
+
+// One allocation like MakeShared, but with the counters and the object on different cache
+// lines. Worth it for objects that many cores read while references are copied and dropped.
+template <typename T, typename Policy, typename... Args>
+SharedPtr<T, Policy> MakeSharedIsolated(Args&&... args) {
+    static_assert(!std::is_array_v<T>, "MakeSharedIsolated does not support arrays");
+    static_assert(!std::is_convertible_v<T*, InlineBlockBase*>,
+                  "InlineSharedFromThis objects keep the counters inside");
+    SharedPtr<T, Policy> sp;
+    auto block = new CBlockIsolated<T, Policy>(std::forward<Args>(args)...);
     sp.ptr_ = reinterpret_cast<T*>(&(block->buffer));
     sp.block_ = block;
     if constexpr (std::is_convertible_v<T*, ESFTBase*>) {
@@ -377,3 +1058,41 @@ SharedPtr<T> MakeShared(Args&&... args) {
     }
     return sp;
 }
+
+template <typename T, typename Policy, typename Alloc, typename... Args>
+SharedPtr<T, Policy> AllocateShared(const Alloc& alloc, Args&&... args) {
+    static_assert(!std::is_convertible_v<T*, InlineBlockBase*>,
+                  "InlineSharedFromThis objects are freed with ::operator delete");
+    using Block = CBlockAllocObj<T, Policy, Alloc>;
+    using BlockTraits = std::allocator_traits<typename Block::BlockAlloc>;
+    typename Block::BlockAlloc block_alloc(alloc);
+    Block* block = BlockTraits::allocate(block_alloc, 1);
+    new (block) Block(alloc);
+    try {
+        typename Block::ObjTraits::allocator_type obj_alloc(alloc);
+        Block::ObjTraits::construct(obj_alloc, const_cast<std::remove_cv_t<T>*>(block->Obj()),
+                                    std::forward<Args>(args)...);
+    } catch (...) {
+        block->~Block();
+        BlockTraits::deallocate(block_alloc, block, 1);
+        throw;
+    }
+    SharedPtr<T, Policy> sp;
+    sp.ptr_ = block->Obj();
+    sp.block_ = block;
+    if constexpr (std::is_convertible_v<T*, ESFTBase*>) {
+        sp.InitWeakThis(sp.ptr_);
+    }
+    return sp;
+}
+
+// Lets the calling thread create n more blocks for MakeShared<T, Policy>, or for
+// SharedPtr<U, Policy>(new U) with T = void, without taking a lock or calling malloc.
+template <typename T = void, typename Policy = SlabPolicy<>>
+void ReserveControlBlocks(size_t n) {
+    if constexpr (std::is_void_v<T>) {
+        BlockAllocator<Policy>::Reserve(sizeof(CBlockPtr<char, Policy>), n);
+    } else {
+        BlockAllocator<Policy>::Reserve(sizeof(CBlockObj<T, Policy>), n);
+    }
+}
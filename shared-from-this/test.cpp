@@ -3,6 +3,10 @@
 
 #include <catch.hpp>
 
+#include "allocations_checker.h"
+
+#include <string>
+
 struct T : public EnableSharedFromThis<T> {};
 
 struct Y : T {};
@@ -69,6 +73,17 @@ TEST_CASE("SharedFromThis") {
         REQUIRE(weak.Expired());
         weak.Reset();
     }
+
+    {
+        T* ptr = new T;
+        SharedPtr<T> s;
+        s.Reset(ptr);
+        REQUIRE(ptr->SharedFromThis() == s);
+        Y* derived = new Z;
+        SharedPtr<T> base;
+        base.Reset(derived);
+        REQUIRE(derived->SharedFromThis() == base);
+    }
 }
 
 TEST_CASE("WeakFromThis") {
@@ -89,3 +104,128 @@ TEST_CASE("WeakFromThis") {
     REQUIRE(!weak.Expired());
     REQUIRE(weak.Lock().Get() == ptr);
 }
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+struct Node : public InlineSharedFromThis<Node> {
+    static inline int alive = 0;
+
+    Node() {
+        ++alive;
+    }
+    ~Node() {
+        --alive;
+    }
+
+    SharedPtr<Node> next;
+};
+
+struct Base : public InlineSharedFromThis<Base, AtomicPolicy> {
+    virtual ~Base() = default;
+};
+
+struct Derived : Base {
+    std::string name = "derived";
+};
+
+// Counts the control blocks whose destructor has not run yet.
+struct CountedPolicy : SingleThreadPolicy {
+    static inline int alive = 0;
+
+    CountedPolicy() {
+        ++alive;
+    }
+    ~CountedPolicy() {
+        --alive;
+    }
+};
+
+struct Counted : public InlineSharedFromThis<Counted, CountedPolicy> {};
+
+TEST_CASE("InlineSharedFromThis") {
+    SECTION("No control block allocations") {
+        Node* ptr = new Node;
+        EXPECT_ZERO_ALLOCATIONS(SharedPtr<Node> sp(ptr); REQUIRE(ptr->SharedFromThis() == sp));
+        EXPECT_ONE_ALLOCATION(auto sp = MakeShared<Node>(); REQUIRE(sp.UseCount() == 1));
+        REQUIRE(Node::alive == 0);
+    }
+
+    SECTION("SharedFromThis") {
+        auto sp = MakeShared<Node>();
+        SharedPtr<Node> copy = sp->SharedFromThis();
+        REQUIRE(copy == sp);
+        REQUIRE(sp.UseCount() == 2);
+        const Node* cptr = sp.Get();
+        SharedPtr<const Node> const_copy = cptr->SharedFromThis();
+        REQUIRE(sp.UseCount() == 3);
+    }
+
+    SECTION("Not owned yet") {
+        Node node;
+        REQUIRE(node.SharedFromThis().Get() == nullptr);
+        REQUIRE(node.WeakFromThis().Expired());
+    }
+
+    SECTION("Weak pointers outlive the object") {
+        WeakPtr<Node> weak;
+        {
+            auto sp = MakeShared<Node>();
+            weak = sp->WeakFromThis();
+            REQUIRE(weak.Lock() == sp);
+        }
+        REQUIRE(Node::alive == 0);
+        REQUIRE(weak.Expired());
+        REQUIRE(weak.Lock().Get() == nullptr);
+    }
+
+    SECTION("Polymorphic") {
+        WeakPtr<Base, AtomicPolicy> weak;
+        {
+            SharedPtr<Base, AtomicPolicy> sp(new Derived);
+            weak = sp->WeakFromThis();
+            REQUIRE(static_cast<Derived*>(sp->SharedFromThis().Get())->name == "derived");
+        }
+        REQUIRE(weak.Expired());
+    }
+
+    SECTION("Reset") {
+        SharedPtr<Node> sp;
+        Node* ptr = new Node;
+        EXPECT_ZERO_ALLOCATIONS(sp.Reset(ptr));
+        SharedPtr<Node> again = ptr->SharedFromThis();
+        REQUIRE(again == sp);
+        REQUIRE(sp.UseCount() == 2);
+
+        SharedPtr<Base, AtomicPolicy> base;
+        auto derived = new Derived;
+        base.Reset(derived);
+        REQUIRE(derived->SharedFromThis() == base);
+        WeakPtr<Base, AtomicPolicy> weak = derived->WeakFromThis();
+        base.Reset();
+        REQUIRE(weak.Expired());
+    }
+
+    SECTION("Control blocks are destroyed") {
+        WeakPtr<Counted, CountedPolicy> weak;
+        {
+            SharedPtr<Counted, CountedPolicy> sp(new Counted);
+            weak = sp->WeakFromThis();
+        }
+        REQUIRE(CountedPolicy::alive == 1);
+        weak.Reset();
+        REQUIRE(CountedPolicy::alive == 0);
+
+        {
+            Counted never_shared;
+        }
+        delete new Counted;
+        REQUIRE(CountedPolicy::alive == 0);
+    }
+
+    SECTION("Copies get their own counters") {
+        auto sp = MakeShared<Node>();
+        Node copy = *sp;
+        REQUIRE(copy.SharedFromThis().Get() == nullptr);
+        REQUIRE(sp->SharedFromThis().UseCount() == 2);
+    }
+}
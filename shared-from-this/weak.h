@@ -4,7 +4,7 @@
 #include "shared.h"
 
 // https://en.cppreference.com/w/cpp/memory/weak_ptr
-template <typename T>
+template <typename T, typename Policy>
 class WeakPtr {
 public:
     WeakPtr() : ptr_(nullptr), block_(nullptr){};
@@ -13,17 +13,15 @@ public:
         SafeWeakIncrement();
     }
     template <typename U>
-    WeakPtr(const WeakPtr<U>& other) : ptr_(other.ptr_), block_(other.block_) {
+    WeakPtr(const WeakPtr<U, Policy>& other) : ptr_(other.ptr_), block_(other.block_) {
         SafeWeakIncrement();
     }
-    WeakPtr(WeakPtr&& other) {
-        ptr_ = other.ptr_;
-        block_ = other.block_;
-        SafeWeakIncrement();
-        other.Reset();
+    WeakPtr(WeakPtr&& other) noexcept : ptr_(other.ptr_), block_(other.block_) {
+        other.ptr_ = nullptr;
+        other.block_ = nullptr;
     }
 
-    WeakPtr(const SharedPtr<T>& other) {
+    WeakPtr(const SharedPtr<T, Policy>& other) {
         ptr_ = other.ptr_;
         block_ = other.block_;
         SafeWeakIncrement();
@@ -36,16 +34,12 @@ public:
         SafeWeakIncrement();
         return *this;
     }
-    WeakPtr& operator=(WeakPtr&& other) {
-        SafeWeakDecrement();
-        ptr_ = other.ptr_;
-        block_ = other.block_;
-        SafeWeakIncrement();
-        other.Reset();
+    WeakPtr& operator=(WeakPtr&& other) noexcept {
+        WeakPtr(std::move(other)).Swap(*this);
         return *this;
     };
 
-    WeakPtr& operator=(SharedPtr<T>& other) {
+    WeakPtr& operator=(SharedPtr<T, Policy>& other) {
         SafeWeakDecrement();
         block_ = other.block_;
         ptr_ = other.ptr_;
@@ -54,7 +48,7 @@ public:
     }
 
     template <typename Y>
-    WeakPtr& operator=(SharedPtr<Y>& other) {
+    WeakPtr& operator=(SharedPtr<Y, Policy>& other) {
         SafeWeakDecrement();
         block_ = other.block_;
         ptr_ = other.ptr_;
@@ -75,7 +69,7 @@ public:
         ptr_ = nullptr;
         block_ = nullptr;
     }
-    void Swap(WeakPtr& other) {
+    void Swap(WeakPtr& other) noexcept {
         std::swap(ptr_, other.ptr_);
         std::swap(block_, other.block_);
     }
@@ -110,27 +104,69 @@ public:
         return block_->IsObjExpired();
     }
 
-    SharedPtr<T> Lock() const {
-        SharedPtr<T> sp = SharedPtr<T>();
-        if (ptr_ == nullptr) {
-            return sp;
+    // See SharedPtr::OwnerBefore.
+    template <typename Other>
+    bool OwnerBefore(const Other& other) const {
+        return std::less<const void*>()(block_, other.block_);
+    }
+    template <typename Other>
+    bool OwnerEqual(const Other& other) const {
+        return static_cast<const void*>(block_) == other.block_;
+    }
+    size_t OwnerHash() const {
+        return std::hash<const void*>()(block_);
+    }
+
+    // See SharedPtr::OnExpire.
+    bool OnExpire(ExpiryHook* hook) const {
+        static_assert(std::is_base_of_v<ExpiryList, Policy>, "OnExpire needs ObservablePolicy");
+        return block_ != nullptr && block_->LinkExpiryHook(hook);
+    }
+
+    // Takes a strong reference only if the object is still alive, so a Lock racing with the
+    // last owner's release never brings a dying object back.
+    SharedPtr<T, Policy> Lock() const {
+        SharedPtr<T, Policy> sp = SharedPtr<T, Policy>();
+        if (ptr_ != nullptr && block_ != nullptr && block_->TryStrongIncrement()) {
+            sp.block_ = block_;
+            sp.ptr_ = ptr_;
         }
-        sp.block_ = block_;
-        sp.ptr_ = ptr_;
-        sp.SafeIncrement();
         return sp;
     };
 
-    template <typename U>
+    // Lock for pointers polled over and over: a failed attempt also resets this WeakPtr, so
+    // later calls on a dead object return at once without touching the control block. It
+    // modifies the pointer, like Reset, so a WeakPtr shared between threads must use Lock.
+    SharedPtr<T, Policy> LockOrReset() {
+        if (block_ == nullptr) {
+            return SharedPtr<T, Policy>();
+        }
+        SharedPtr<T, Policy> sp = Lock();
+        if (sp.block_ == nullptr) {
+            Reset();
+        }
+        return sp;
+    }
+
+    template <typename U, typename P>
     friend class SharedPtr;
 
-    template <typename U>
+    template <typename U, typename P>
     friend class EnableSharedFromThis;
 
-    template <typename U>
+    template <typename U, typename P>
     friend class WeakPtr;
 
+    template <typename Handle>
+    friend class AtomicSlot;
+
+    template <typename U, typename P>
+    friend class InlineSharedFromThis;
+
 private:
-    T* ptr_;
-    BaseBlock* block_;
+    std::remove_extent_t<T>* ptr_;
+    BaseBlock<Policy>* block_;
 };
+
+template <typename T, typename Policy>
+struct IsTriviallyRelocatable<WeakPtr<T, Policy>> : std::true_type {};
@@ -0,0 +1,311 @@
+#include "shared.h"
+#include "biased.h"
+#include "compressed.h"
+
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <new>
+#include <random>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// Counts malloc calls on the current thread, for the allocs/iter counters. GCC sees these
+// inlined into every new and delete and takes malloc and free for a mismatched pair.
+
+thread_local size_t num_allocations = 0;
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+
+void* operator new(size_t size) {
+    ++num_allocations;
+    if (void* ptr = std::malloc(size)) {
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* ptr) noexcept {
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept {
+    std::free(ptr);
+}
+
+#pragma GCC diagnostic pop
+
+void ReportAllocations(benchmark::State& state, size_t before) {
+    state.counters["allocs/iter"] =
+        static_cast<double>(num_allocations - before) / static_cast<double>(state.iterations());
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// A request handler that passes the same object down a few layers by value.
+
+struct Request {
+    std::string path = "/api/v1/resource";
+    int id = 0;
+};
+
+template <typename Ptr>
+int Handle(Ptr request, int depth) {
+    if (depth == 0) {
+        return request->id;
+    }
+    return Handle(request, depth - 1);
+}
+
+template <typename Policy>
+void BM_CopyDestroy(benchmark::State& state) {
+    auto sp = MakeShared<Request, Policy>();
+    for (auto _ : state) {
+        SharedPtr<Request, Policy> copy = sp;
+        benchmark::DoNotOptimize(copy);
+    }
+}
+
+template <typename Policy>
+void BM_Get(benchmark::State& state) {
+    auto sp = MakeShared<Request, Policy>();
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(sp.Get());
+    }
+}
+
+template <typename Policy>
+void BM_RequestPath(benchmark::State& state) {
+    auto sp = MakeShared<Request, Policy>();
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(Handle(sp, 8));
+    }
+}
+
+template <typename Policy>
+void BM_MakeShared(benchmark::State& state) {
+    size_t before = num_allocations;
+    for (auto _ : state) {
+        auto sp = MakeShared<Request, Policy>();
+        benchmark::DoNotOptimize(sp);
+    }
+    ReportAllocations(state, before);
+}
+
+template <typename Policy>
+void BM_FromRawPointer(benchmark::State& state) {
+    size_t before = num_allocations;
+    for (auto _ : state) {
+        SharedPtr<Request, Policy> sp(new Request);
+        benchmark::DoNotOptimize(sp);
+    }
+    ReportAllocations(state, before);
+}
+
+// Keeps a batch of objects alive, so blocks go through the whole free list and, with several
+// threads, through the shared depot.
+template <typename Policy>
+void BM_MakeSharedBatch(benchmark::State& state) {
+    std::vector<SharedPtr<int, Policy>> batch(1024);
+    size_t before = num_allocations;
+    for (auto _ : state) {
+        for (auto& sp : batch) {
+            sp = MakeShared<int, Policy>();
+        }
+        for (auto& sp : batch) {
+            sp.Reset();
+        }
+    }
+    ReportAllocations(state, before);
+    state.SetItemsProcessed(state.iterations() * batch.size());
+}
+
+// Every MakeShared signature below instantiates the same CBlockObj<Request, Policy>.
+template <typename Policy>
+void BM_MakeSharedMixedArgs(benchmark::State& state) {
+    for (auto _ : state) {
+        auto a = MakeShared<Request, Policy>();
+        auto b = MakeShared<Request, Policy>(Request{});
+        auto c = MakeShared<Request, Policy>(*a);
+        auto d = MakeShared<Request, Policy>(std::move(*b));
+        benchmark::DoNotOptimize(a);
+        benchmark::DoNotOptimize(c);
+        benchmark::DoNotOptimize(d);
+    }
+}
+
+// Threads copy an object created by somebody else: the foreign path of BiasedPolicy.
+template <typename Policy>
+void BM_ForeignCopyDestroy(benchmark::State& state) {
+    static SharedPtr<Request, Policy> shared;
+    if (state.thread_index() == 0) {
+        std::thread([] { shared = MakeShared<Request, Policy>(); }).join();
+    }
+    for (auto _ : state) {
+        SharedPtr<Request, Policy> copy = shared;
+        benchmark::DoNotOptimize(copy);
+    }
+    if (state.thread_index() == 0) {
+        shared.Reset();
+    }
+}
+
+void BM_StdCopyDestroy(benchmark::State& state) {
+    auto sp = std::make_shared<Request>();
+    for (auto _ : state) {
+        std::shared_ptr<Request> copy = sp;
+        benchmark::DoNotOptimize(copy);
+    }
+}
+
+void BM_StdRequestPath(benchmark::State& state) {
+    auto sp = std::make_shared<Request>();
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(Handle(sp, 8));
+    }
+}
+
+// Containers of pointers: growth and sorting only move elements around.
+
+constexpr int kNumElements = 10'000'000;
+
+template <typename Ptr>
+std::vector<Ptr> MakeShuffled() {
+    std::vector<Ptr> pointers;
+    pointers.reserve(kNumElements);
+    for (int i = 0; i < kNumElements; ++i) {
+        pointers.push_back(Ptr(new int(i)));
+    }
+    std::shuffle(pointers.begin(), pointers.end(), std::mt19937(42));
+    return pointers;
+}
+
+template <typename Ptr>
+void BM_VectorGrowth(benchmark::State& state) {
+    auto source = MakeShuffled<Ptr>();
+    for (auto _ : state) {
+        std::vector<Ptr> grown;
+        for (auto& ptr : source) {
+            grown.push_back(std::move(ptr));
+        }
+        state.PauseTiming();
+        std::move(grown.begin(), grown.end(), source.begin());
+        state.ResumeTiming();
+    }
+}
+
+template <typename Ptr>
+void BM_Sort(benchmark::State& state) {
+    auto source = MakeShuffled<Ptr>();
+    for (auto _ : state) {
+        state.PauseTiming();
+        std::vector<Ptr> pointers = source;
+        state.ResumeTiming();
+        std::sort(pointers.begin(), pointers.end(),
+                  [](const Ptr& left, const Ptr& right) { return *left < *right; });
+        benchmark::DoNotOptimize(pointers.data());
+    }
+}
+
+// Thread 0 keeps copying and dropping a reference while the other threads only read the object.
+// With MakeShared the counters share a cache line with the fields, so every copy takes that line
+// away from the readers; MakeSharedIsolated keeps them apart.
+
+struct Quote {
+    int64_t bid = 100;
+    int64_t ask = 101;
+};
+
+template <bool kIsolated>
+void BM_ReadWhileCounting(benchmark::State& state) {
+    static SharedPtr<Quote, AtomicPolicy> quote = kIsolated
+                                                      ? MakeSharedIsolated<Quote, AtomicPolicy>()
+                                                      : MakeShared<Quote, AtomicPolicy>();
+    for (auto _ : state) {
+        if (state.thread_index() == 0) {
+            SharedPtr<Quote, AtomicPolicy> copy = quote;
+            benchmark::DoNotOptimize(copy);
+        } else {
+            benchmark::DoNotOptimize(quote->bid + quote->ask);
+        }
+    }
+}
+
+// A binary tree walked depth-first. With compressed pointers a node takes 12 bytes instead of
+// 40, so more of the tree stays in cache, at the price of decoding every link.
+template <template <typename...> class Ptr>
+struct TreeNode {
+    Ptr<TreeNode> left;
+    Ptr<TreeNode> right;
+    int32_t value = 1;
+};
+
+template <template <typename...> class Ptr>
+Ptr<TreeNode<Ptr>> BuildTree(int depth) {
+    if (depth == 0) {
+        return nullptr;
+    }
+    Ptr<TreeNode<Ptr>> node;
+    if constexpr (std::is_same_v<Ptr<int>, CompressedSharedPtr<int>>) {
+        node = MakeCompressedShared<TreeNode<Ptr>>();
+    } else {
+        node = MakeShared<TreeNode<Ptr>>();
+    }
+    node->left = BuildTree<Ptr>(depth - 1);
+    node->right = BuildTree<Ptr>(depth - 1);
+    return node;
+}
+
+template <typename Node>
+int64_t SumTree(const Node* node) {
+    return node ? node->value + SumTree(node->left.Get()) + SumTree(node->right.Get()) : 0;
+}
+
+template <template <typename...> class Ptr>
+void BM_TreeWalk(benchmark::State& state) {
+    auto root = BuildTree<Ptr>(state.range(0));
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(SumTree(root.Get()));
+    }
+    state.counters["node_bytes"] = sizeof(TreeNode<Ptr>);
+}
+
+BENCHMARK_TEMPLATE(BM_CopyDestroy, SingleThreadPolicy);
+BENCHMARK_TEMPLATE(BM_CopyDestroy, AtomicPolicy);
+BENCHMARK_TEMPLATE(BM_CopyDestroy, BiasedPolicy);
+BENCHMARK(BM_StdCopyDestroy);
+BENCHMARK_TEMPLATE(BM_Get, SingleThreadPolicy);
+BENCHMARK_TEMPLATE(BM_RequestPath, SingleThreadPolicy);
+BENCHMARK_TEMPLATE(BM_RequestPath, AtomicPolicy);
+BENCHMARK_TEMPLATE(BM_RequestPath, BiasedPolicy);
+BENCHMARK(BM_StdRequestPath);
+BENCHMARK_TEMPLATE(BM_MakeShared, SingleThreadPolicy);
+BENCHMARK_TEMPLATE(BM_MakeShared, AtomicPolicy);
+BENCHMARK_TEMPLATE(BM_MakeShared, BiasedPolicy);
+BENCHMARK_TEMPLATE(BM_MakeShared, SlabPolicy<SingleThreadPolicy>);
+BENCHMARK_TEMPLATE(BM_MakeShared, SlabPolicy<AtomicPolicy>);
+BENCHMARK_TEMPLATE(BM_FromRawPointer, SingleThreadPolicy);
+BENCHMARK_TEMPLATE(BM_FromRawPointer, SlabPolicy<SingleThreadPolicy>);
+BENCHMARK_TEMPLATE(BM_MakeSharedBatch, AtomicPolicy)->Threads(1)->Threads(4);
+BENCHMARK_TEMPLATE(BM_MakeSharedBatch, SlabPolicy<AtomicPolicy>)->Threads(1)->Threads(4);
+BENCHMARK_TEMPLATE(BM_MakeSharedMixedArgs, SingleThreadPolicy);
+BENCHMARK_TEMPLATE(BM_ForeignCopyDestroy, AtomicPolicy)->Threads(1)->Threads(4);
+BENCHMARK_TEMPLATE(BM_ForeignCopyDestroy, BiasedPolicy)->Threads(1)->Threads(4);
+BENCHMARK_TEMPLATE(BM_VectorGrowth, SharedPtr<int>)->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(BM_VectorGrowth, SharedPtr<int, AtomicPolicy>)->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(BM_VectorGrowth, std::shared_ptr<int>)->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(BM_Sort, SharedPtr<int>)->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(BM_Sort, SharedPtr<int, AtomicPolicy>)->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(BM_Sort, std::shared_ptr<int>)->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(BM_ReadWhileCounting, false)->ThreadRange(2, 64)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_ReadWhileCounting, true)->ThreadRange(2, 64)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_TreeWalk, SharedPtr)->DenseRange(14, 20, 3);
+BENCHMARK_TEMPLATE(BM_TreeWalk, CompressedSharedPtr)->DenseRange(14, 20, 3);
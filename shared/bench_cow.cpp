@@ -0,0 +1,74 @@
+#include "shared.h"
+#include "cow.h"
+
+#include <benchmark/benchmark.h>
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <type_traits>
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// Values that are copied on every hand-off and written to once in a while: every
+// `writes_every`-th copy gets a single element changed. Eager copies pay for the whole value on
+// every hand-off; Cow pays a reference count, plus one clone per write.
+
+std::map<int, std::string> MakeMap(int64_t size) {
+    std::map<int, std::string> map;
+    for (int i = 0; i < size; ++i) {
+        map.emplace(i, std::string(24, 'a' + i % 26));
+    }
+    return map;
+}
+
+template <typename Value>
+void Mutate(Value* value, int64_t step) {
+    if constexpr (std::is_same_v<Value, std::string>) {
+        (*value)[step % value->size()] = 'x';
+    } else {
+        (*value)[static_cast<int>(step % value->size())] = "x";
+    }
+}
+
+template <typename Value>
+Value MakeValue(int64_t size) {
+    if constexpr (std::is_same_v<Value, std::string>) {
+        return std::string(size * 32, 'a');
+    } else {
+        return MakeMap(size);
+    }
+}
+
+template <typename Value>
+void BM_EagerCopy(benchmark::State& state) {
+    Value original = MakeValue<Value>(state.range(0));
+    int64_t writes_every = state.range(1);
+    int64_t step = 0;
+    for (auto _ : state) {
+        Value copy = original;
+        if (++step % writes_every == 0) {
+            Mutate(&copy, step);
+        }
+        benchmark::DoNotOptimize(copy.size());
+    }
+}
+
+template <typename Value>
+void BM_CowCopy(benchmark::State& state) {
+    Cow<Value> original = MakeValue<Value>(state.range(0));
+    int64_t writes_every = state.range(1);
+    int64_t step = 0;
+    for (auto _ : state) {
+        Cow<Value> copy = original;
+        if (++step % writes_every == 0) {
+            Mutate(&copy.Write(), step);
+        }
+        benchmark::DoNotOptimize(copy->size());
+    }
+}
+
+BENCHMARK_TEMPLATE(BM_EagerCopy, std::string)->ArgsProduct({{32, 4096}, {1, 100}});
+BENCHMARK_TEMPLATE(BM_CowCopy, std::string)->ArgsProduct({{32, 4096}, {1, 100}});
+BENCHMARK_TEMPLATE(BM_EagerCopy, std::map<int, std::string>)->ArgsProduct({{32, 4096}, {1, 100}});
+BENCHMARK_TEMPLATE(BM_CowCopy, std::map<int, std::string>)->ArgsProduct({{32, 4096}, {1, 100}});
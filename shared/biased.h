@@ -0,0 +1,237 @@
+#pragma once
+
+#include "shared.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <type_traits>
+#include <vector>
+
+// Biased reference counting: SharedPtr<T, BiasedPolicy>.
+//
+// The thread that created the control block (its owner) counts its strong references in a plain
+// integer. Other threads use an atomic word that holds their count in the high bits (it may go
+// negative while the owner still holds references), a "merged" flag in bit 0 and a "queued" flag
+// in bit 1. When the owner's count drops to zero it merges the two and stops being special:
+// from then on every thread uses the atomic word.
+//
+// If a foreign thread drives the atomic count below zero, the owner may be the only one left
+// holding the object, so the block is queued to the owner. The owner merges its queue on its
+// next release, on BiasedPolicy::MergeQueued() and when it exits; once the owner thread is gone
+// the foreign thread merges the block itself. Such objects are therefore destroyed a little
+// later, on the owner thread.
+
+class BiasedPolicy;
+
+// Per-thread record of blocks waiting for their owner. The thread and every block it created
+// hold a reference to it, so it outlives the thread while its blocks are still around. Biased
+// blocks must not be created from thread_local destructors.
+struct BiasedOwner {
+    static BiasedOwner*& Local() {
+        thread_local BiasedOwner* owner = nullptr;
+        return owner;
+    }
+
+    static BiasedOwner* Current() {
+        BiasedOwner*& owner = Local();
+        if (owner == nullptr) {
+            thread_local Registration registration;
+            owner = registration.owner;
+        }
+        return owner;
+    }
+
+    // Returns false if the owner thread has already exited.
+    bool TryEnqueue(BiasedPolicy* cnt) {
+        std::lock_guard lock(mutex);
+        if (exited) {
+            return false;
+        }
+        queued.push_back(cnt);
+        has_queued.store(true, std::memory_order_release);
+        return true;
+    }
+
+    std::vector<BiasedPolicy*> TakeQueued(bool exiting) {
+        std::lock_guard lock(mutex);
+        exited = exiting;
+        has_queued.store(false, std::memory_order_relaxed);
+        return std::move(queued);
+    }
+
+    static BiasedOwner* Acquire(BiasedOwner* owner) {
+        owner->refs.fetch_add(1, std::memory_order_relaxed);
+        return owner;
+    }
+
+    static void Release(BiasedOwner* owner) {
+        if (owner->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            delete owner;
+        }
+    }
+
+    struct Registration {
+        Registration() : owner(new BiasedOwner) {
+        }
+        ~Registration();
+
+        BiasedOwner* owner;
+    };
+
+    std::atomic<size_t> refs = 1;
+    std::mutex mutex;
+    std::vector<BiasedPolicy*> queued;
+    std::atomic<bool> has_queued = false;
+    bool exited = false;
+};
+
+class BiasedPolicy {
+public:
+    BiasedPolicy() : owner_(BiasedOwner::Acquire(BiasedOwner::Current())) {
+    }
+
+    BiasedPolicy(const BiasedPolicy&) = delete;
+    BiasedPolicy& operator=(const BiasedPolicy&) = delete;
+
+    ~BiasedPolicy() {
+        BiasedOwner::Release(owner_);
+    }
+
+    void StrongIncrement() {
+        if (IsOwner()) {
+            ++local_cnt_;
+        } else {
+            shared_.fetch_add(kOne, std::memory_order_relaxed);
+        }
+    }
+
+    // Before the merge the owner still holds a reference, so the object cannot be gone yet. A
+    // foreign upgrade that lands while the block waits in the owner's queue is simply counted
+    // by the merge.
+    bool TryStrongIncrement() {
+        if (IsOwner()) {
+            ++local_cnt_;
+            return true;
+        }
+        int64_t cur = shared_.load(std::memory_order_relaxed);
+        do {
+            if ((cur & kMerged) && Count(cur) == 0) {
+                return false;
+            }
+        } while (!shared_.compare_exchange_weak(cur, cur + kOne, std::memory_order_relaxed));
+        return true;
+    }
+
+    // Returns zero only for the last reference; otherwise the value is a lower bound.
+    size_t StrongDecrement() {
+        if (IsOwner()) {
+            if (owner_->has_queued.load(std::memory_order_relaxed)) {
+                MergeQueued();
+                if (!IsOwner()) {  // This block was in the queue too.
+                    return ForeignDecrement();
+                }
+            }
+            if (--local_cnt_ != 0) {
+                return local_cnt_;
+            }
+            return Merge();
+        }
+        return ForeignDecrement();
+    }
+
+    void WeakIncrement() {
+        weak_cnt_.fetch_add(1, std::memory_order_relaxed);
+    }
+    size_t WeakDecrement() {
+        return weak_cnt_.fetch_sub(1, std::memory_order_acq_rel) - 1;
+    }
+
+    // Exact on the owner thread and after the merge; elsewhere only a non-zero lower bound.
+    size_t StrongCount() const {
+        int64_t shared = shared_.load(std::memory_order_acquire);
+        if (shared & kMerged) {
+            return Count(shared);
+        }
+        if (IsOwner()) {
+            return local_cnt_ + Count(shared);
+        }
+        return std::max<int64_t>(Count(shared), 0) + 1;
+    }
+    size_t WeakCount() const {
+        return weak_cnt_.load(std::memory_order_acquire);
+    }
+
+    // Merges every block queued to the calling thread, destroying the ones nobody holds anymore.
+    static void MergeQueued() {
+        if (BiasedOwner* owner = BiasedOwner::Local()) {
+            MergeAll(owner->TakeQueued(false));
+        }
+    }
+
+    static void MergeAll(std::vector<BiasedPolicy*> queued);
+
+private:
+    static constexpr int64_t kMerged = 1;
+    static constexpr int64_t kQueued = 2;
+    static constexpr int64_t kOne = 4;
+
+    static int64_t Count(int64_t shared) {
+        return shared >> 2;
+    }
+
+    // Only the owner sets the merged flag while it is alive, so it always sees its own write.
+    bool IsOwner() const {
+        return owner_ == BiasedOwner::Local() && !(shared_.load(std::memory_order_relaxed) & kMerged);
+    }
+
+    size_t ForeignDecrement() {
+        int64_t old = shared_.fetch_sub(kOne, std::memory_order_acq_rel);
+        if (old & kMerged) {
+            return Count(old) - 1;
+        }
+        if (Count(old) - 1 < 0 && !(shared_.fetch_or(kQueued, std::memory_order_relaxed) & kQueued)) {
+            WeakIncrement();  // Keeps the block alive while it sits in the queue.
+            if (!owner_->TryEnqueue(this)) {
+                // The owner has exited, nobody else can touch its count.
+                size_t left = Merge();
+                WeakDecrement();
+                return left;
+            }
+        }
+        return 1;
+    }
+
+    // Folds the owner's count into the shared one and returns the total. Runs on the owner
+    // thread, or on the thread that found the owner exited.
+    size_t Merge() {
+        int64_t add = static_cast<int64_t>(local_cnt_) * kOne + kMerged;
+        local_cnt_ = 0;
+        return Count(shared_.fetch_add(add, std::memory_order_acq_rel) + add);
+    }
+
+    BiasedOwner* const owner_;
+    size_t local_cnt_ = 1;
+    std::atomic<int64_t> shared_ = 0;
+    std::atomic<size_t> weak_cnt_ = 1;
+};
+
+inline void BiasedPolicy::MergeAll(std::vector<BiasedPolicy*> queued) {
+    // The counters are the first member of a standard-layout block, so the addresses match.
+    static_assert(std::is_standard_layout_v<BaseBlock<BiasedPolicy>>);
+    for (BiasedPolicy* cnt : queued) {
+        auto block = reinterpret_cast<BaseBlock<BiasedPolicy>*>(cnt);
+        if (!(cnt->shared_.load(std::memory_order_relaxed) & kMerged) && cnt->Merge() == 0) {
+            block->hook(block, BlockOp::kDisposeObj);
+            block->WeakDecrement();
+        }
+        block->WeakDecrement();
+    }
+}
+
+inline BiasedOwner::Registration::~Registration() {
+    BiasedPolicy::MergeAll(owner->TakeQueued(true));
+    Local() = nullptr;
+    Release(owner);
+}
@@ -0,0 +1,147 @@
+#pragma once
+
+#include "shared.h"
+
+#include <common/compressed_arena.h>
+#include <common/relocatable.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+#include <utility>
+
+// CompressedSharedPtr<T>: a SharedPtr that is a 32-bit offset of its control block inside the
+// CompressedArena, half the size of a ThinSharedPtr. Objects are created only by
+// MakeCompressedShared, which puts the block and the object into the arena with one
+// allocation; like ThinSharedPtr, there is no aliasing, and a CompressedSharedPtr converts to
+// a regular SharedPtr when one is needed.
+
+template <typename T, typename Policy>
+struct CBlockArena : BaseBlock<Policy> {
+public:
+    template <typename... Args>
+    CBlockArena(Args&&... args) : BaseBlock<Policy>(&CBlockArena::Hook) {
+        new (&buffer) T(std::forward<Args>(args)...);
+    };
+
+    static void Hook(BaseBlock<Policy>* base, BlockOp op) {
+        auto self = static_cast<CBlockArena*>(base);
+        if (op == BlockOp::kDisposeObj) {
+            reinterpret_cast<T*>(&self->buffer)->~T();
+        } else {
+            self->~CBlockArena();
+            CompressedArena::Deallocate(self, sizeof(CBlockArena));
+        }
+    }
+
+    std::aligned_storage_t<sizeof(T), alignof(T)> buffer;
+};
+
+template <typename T, typename Policy = SingleThreadPolicy>
+class CompressedSharedPtr {
+    static_assert(!std::is_array_v<T>, "CompressedSharedPtr does not support arrays");
+
+public:
+    CompressedSharedPtr() = default;
+    CompressedSharedPtr(std::nullptr_t) {
+    }
+
+    CompressedSharedPtr(const CompressedSharedPtr& other) : offset_(other.offset_) {
+        if (offset_ != 0) {
+            GetBlock()->StrongIncrement();
+        }
+    }
+    CompressedSharedPtr(CompressedSharedPtr&& other) noexcept
+        : offset_(std::exchange(other.offset_, 0)) {
+    }
+
+    CompressedSharedPtr& operator=(const CompressedSharedPtr& other) {
+        CompressedSharedPtr(other).Swap(*this);
+        return *this;
+    }
+    CompressedSharedPtr& operator=(CompressedSharedPtr&& other) noexcept {
+        CompressedSharedPtr(std::move(other)).Swap(*this);
+        return *this;
+    }
+
+    ~CompressedSharedPtr() {
+        if (offset_ != 0) {
+            GetBlock()->StrongDecrement();
+        }
+    }
+
+    void Reset() {
+        CompressedSharedPtr().Swap(*this);
+    }
+    void Swap(CompressedSharedPtr& other) noexcept {
+        std::swap(offset_, other.offset_);
+    }
+
+    T* Get() const {
+        return offset_ ? reinterpret_cast<T*>(&GetBlock()->buffer) : nullptr;
+    }
+    T& operator*() const {
+        return *Get();
+    }
+    T* operator->() const {
+        return Get();
+    }
+    size_t UseCount() const {
+        return offset_ ? GetBlock()->GetStrongCount() : 0;
+    }
+    explicit operator bool() const {
+        return offset_ != 0;
+    }
+
+    // A regular SharedPtr sharing ownership with this one.
+    operator SharedPtr<T, Policy>() const {
+        SharedPtr<T, Policy> sp;
+        if (offset_ != 0) {
+            GetBlock()->StrongIncrement();
+            sp.ptr_ = Get();
+            sp.block_ = GetBlock();
+        }
+        return sp;
+    }
+
+private:
+    using Block = CBlockArena<T, Policy>;
+
+    explicit CompressedSharedPtr(Block* block) : offset_(CompressedArena::Encode(block)) {
+    }
+
+    Block* GetBlock() const {
+        return static_cast<Block*>(CompressedArena::Decode(offset_));
+    }
+
+    template <typename U, typename P, typename... Args>
+    friend CompressedSharedPtr<U, P> MakeCompressedShared(Args&&... args);
+
+    uint32_t offset_ = 0;
+};
+
+template <typename T, typename U, typename Policy>
+bool operator==(const CompressedSharedPtr<T, Policy>& left,
+                const CompressedSharedPtr<U, Policy>& right) {
+    return left.Get() == right.Get();
+}
+
+template <typename T, typename Policy = SingleThreadPolicy, typename... Args>
+CompressedSharedPtr<T, Policy> MakeCompressedShared(Args&&... args) {
+    static_assert(!std::is_convertible_v<T*, ESFTBase*> &&
+                      !std::is_convertible_v<T*, InlineBlockBase*>,
+                  "SharedFromThis needs a regular SharedPtr");
+    using Block = CBlockArena<T, Policy>;
+    static_assert(alignof(Block) <= CompressedArena::kAlignment,
+                  "Over-aligned types do not fit into the arena");
+    void* memory = CompressedArena::Allocate(sizeof(Block));
+    try {
+        return CompressedSharedPtr<T, Policy>(new (memory) Block(std::forward<Args>(args)...));
+    } catch (...) {
+        CompressedArena::Deallocate(memory, sizeof(Block));
+        throw;
+    }
+}
+
+template <typename T, typename Policy>
+struct IsTriviallyRelocatable<CompressedSharedPtr<T, Policy>> : std::true_type {};
@@ -0,0 +1,88 @@
+#pragma once
+
+#include "shared.h"
+
+#include <common/relocatable.h>
+
+#include <cstddef>
+#include <type_traits>
+#include <utility>
+
+// Cow<T>: a value with copy-on-write. Copying a Cow copies a SharedPtr, reading goes straight
+// to the shared object, and Write() clones it only if somebody else still holds it, that is if
+// UseCount() > 1; the sole owner mutates in place. No WeakPtr is ever handed out, so nobody can
+// gain a reference while we are writing. Sharing Cows between threads takes AtomicPolicy.
+//
+// A reference returned by Write() is good until this Cow is next copied: a copy taken after
+// that shares the object, and writes through the old reference would show through it. A
+// moved-from Cow may only be assigned to or destroyed.
+
+template <typename T, typename Policy = SingleThreadPolicy>
+class Cow {
+    static_assert(!std::is_array_v<T> && !std::is_const_v<T>, "Cow needs a plain value type");
+
+public:
+    Cow() : ptr_(MakeShared<T, Policy>()) {
+    }
+    Cow(const T& value) : ptr_(MakeShared<T, Policy>(value)) {
+    }
+    Cow(T&& value) : ptr_(MakeShared<T, Policy>(std::move(value))) {
+    }
+
+    Cow(const Cow& other) = default;
+    Cow(Cow&& other) noexcept = default;
+    Cow& operator=(const Cow& other) = default;
+    Cow& operator=(Cow&& other) noexcept = default;
+
+    const T& Read() const {
+        return *ptr_;
+    }
+    const T& operator*() const {
+        return *ptr_;
+    }
+    const T* operator->() const {
+        return ptr_.Get();
+    }
+
+    // The object, cloned first if it is shared.
+    T& Write() {
+        if (ptr_.UseCount() > 1) {
+            ptr_ = MakeShared<T, Policy>(std::as_const(*ptr_));
+        }
+        return *ptr_;
+    }
+
+    bool IsShared() const {
+        return ptr_.UseCount() > 1;
+    }
+    size_t UseCount() const {
+        return ptr_.UseCount();
+    }
+
+    void Swap(Cow& other) noexcept {
+        ptr_.Swap(other.ptr_);
+    }
+
+private:
+    explicit Cow(SharedPtr<T, Policy> ptr) : ptr_(std::move(ptr)) {
+    }
+
+    template <typename U, typename P, typename... Args>
+    friend Cow<U, P> MakeCow(Args&&... args);
+
+    SharedPtr<T, Policy> ptr_;
+};
+
+// Copies of one another compare equal without looking at the values.
+template <typename T, typename Policy>
+bool operator==(const Cow<T, Policy>& left, const Cow<T, Policy>& right) {
+    return &*left == &*right || *left == *right;
+}
+
+template <typename T, typename Policy = SingleThreadPolicy, typename... Args>
+Cow<T, Policy> MakeCow(Args&&... args) {
+    return Cow<T, Policy>(MakeShared<T, Policy>(std::forward<Args>(args)...));
+}
+
+template <typename T, typename Policy>
+struct IsTriviallyRelocatable<Cow<T, Policy>> : std::true_type {};
@@ -1,10 +1,19 @@
 #include "shared.h"
+#include "compressed.h"
+#include "cow.h"
 
 #include <catch.hpp>
 
 #include "allocations_checker.h"
 
+#include <common/tracking_allocator.h>
+
+#include <array>
+#include <cstring>
+#include <map>
 #include <memory>
+#include <string>
+#include <vector>
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
@@ -476,3 +485,497 @@ TEST_CASE("Destructor for correct type") {
         REQUIRE(B::destructor_called);
     }
 }
+
+TEST_CASE("Packed counters") {
+    SECTION("Header size") {
+        static_assert(sizeof(BaseBlock<PackedPolicy>) == 16);
+        static_assert(sizeof(BaseBlock<PackedAtomicPolicy>) == 16);
+        static_assert(sizeof(CBlockObj<int, PackedPolicy>) < sizeof(CBlockObj<int, SingleThreadPolicy>));
+    }
+
+    SECTION("Counting") {
+        ModifiersC::count = 0;
+        {
+            SharedPtr<ModifiersC, PackedPolicy> a = MakeShared<ModifiersC, PackedPolicy>();
+            SharedPtr<ModifiersC, PackedPolicy> b(new ModifiersC);
+            {
+                SharedPtr<ModifiersC, PackedPolicy> c = a;
+                b = c;
+                REQUIRE(a.UseCount() == 3);
+                REQUIRE(ModifiersC::count == 1);
+            }
+            REQUIRE(b.UseCount() == 2);
+            a.Reset();
+            REQUIRE(b.UseCount() == 1);
+        }
+        REQUIRE(ModifiersC::count == 0);
+    }
+
+    SECTION("One allocation") {
+        EXPECT_ONE_ALLOCATION(REQUIRE(*MakeShared<int, PackedPolicy>(42) == 42));
+    }
+}
+
+TEST_CASE("AllocateShared") {
+    SECTION("Goes through the allocator") {
+        AllocationStats stats;
+        TrackingAllocator<int> alloc(&stats);
+        ModifiersC::count = 0;
+        {
+            EXPECT_ZERO_ALLOCATIONS(auto sp = AllocateShared<ModifiersC>(alloc));
+        }
+        {
+            auto sp = AllocateShared<ModifiersC>(alloc);
+            SharedPtr<ModifiersC> copy = sp;
+            REQUIRE(sp.UseCount() == 2);
+            REQUIRE(ModifiersC::count == 1);
+        }
+        REQUIRE(ModifiersC::count == 0);
+        REQUIRE(stats.allocations == 2);
+        REQUIRE(stats.deallocations == 2);
+    }
+
+    SECTION("Empty allocator takes no space") {
+        static_assert(sizeof(CBlockAllocObj<int, SingleThreadPolicy, std::allocator<int>>) ==
+                      sizeof(CBlockObj<int, SingleThreadPolicy>));
+        EXPECT_ONE_ALLOCATION(REQUIRE(*AllocateShared<int>(std::allocator<int>(), 42) == 42));
+    }
+
+    SECTION("Faulty constructor") {
+        AllocationStats stats;
+        try {
+            auto sp = AllocateShared<Throwing>(TrackingAllocator<Throwing>(&stats));
+        } catch (...) {
+        }
+        REQUIRE(stats.allocations == 1);
+        REQUIRE(stats.deallocations == 1);
+    }
+
+    SECTION("Policy") {
+        AllocationStats stats;
+        {
+            auto sp = AllocateShared<int, PackedPolicy>(TrackingAllocator<int>(&stats), 7);
+            REQUIRE(*sp == 7);
+        }
+        REQUIRE(stats.deallocations == 1);
+    }
+}
+
+struct ThrowingThird {
+    static int constructed;
+
+    ThrowingThird() {
+        if (++constructed == 3) {
+            throw 42;
+        }
+        ++ModifiersC::count;
+    }
+    ~ThrowingThird() {
+        --ModifiersC::count;
+    }
+};
+
+int ThrowingThird::constructed = 0;
+
+struct alignas(64) OverAligned {
+    char data[3];
+};
+
+TEST_CASE("Arrays") {
+    SECTION("From new[]") {
+        ModifiersC::count = 0;
+        {
+            SharedPtr<ModifiersC[]> sp(new ModifiersC[5]);
+            SharedPtr<ModifiersC[]> copy = sp;
+            REQUIRE(&copy[4] == sp.Get() + 4);
+            REQUIRE(ModifiersC::count == 5);
+        }
+        REQUIRE(ModifiersC::count == 0);
+    }
+
+    SECTION("MakeShared") {
+        ModifiersC::count = 0;
+        {
+            EXPECT_ONE_ALLOCATION(auto sp = MakeShared<ModifiersC[]>(100));
+            auto ints = MakeShared<int[]>(1000);
+            for (int i = 0; i < 1000; ++i) {
+                REQUIRE(ints[i] == 0);
+            }
+            ints[999] = 42;
+            REQUIRE(ints.Get()[999] == 42);
+
+            auto sp = MakeShared<ModifiersC[], AtomicPolicy>(10);
+            REQUIRE(ModifiersC::count == 10);
+        }
+        REQUIRE(ModifiersC::count == 0);
+    }
+
+    SECTION("Bounded") {
+        auto sp = MakeShared<int[3]>();
+        REQUIRE(sp[2] == 0);
+    }
+
+    SECTION("Alignment") {
+        auto sp = MakeShared<OverAligned[]>(3);
+        for (int i = 0; i < 3; ++i) {
+            REQUIRE(reinterpret_cast<uintptr_t>(&sp[i]) % 64 == 0);
+        }
+        auto doubles = MakeShared<double[]>(3);
+        REQUIRE(reinterpret_cast<uintptr_t>(doubles.Get()) % alignof(double) == 0);
+    }
+
+    SECTION("Faulty constructor") {
+        ModifiersC::count = 0;
+        ThrowingThird::constructed = 0;
+        REQUIRE_THROWS(MakeShared<ThrowingThird[]>(5));
+        REQUIRE(ModifiersC::count == 0);
+    }
+
+    SECTION("Empty") {
+        auto sp = MakeShared<ModifiersC[]>(0);
+        REQUIRE(sp.UseCount() == 1);
+    }
+}
+
+TEST_CASE("MakeSharedForOverwrite") {
+    SECTION("One allocation") {
+        EXPECT_ONE_ALLOCATION(auto sp = MakeSharedForOverwrite<char[]>(1 << 20));
+        EXPECT_ONE_ALLOCATION(auto sp = MakeSharedForOverwrite<int>());
+    }
+
+    SECTION("Constructs non-trivial types") {
+        ModifiersC::count = 0;
+        {
+            auto one = MakeSharedForOverwrite<ModifiersC>();
+            auto many = MakeSharedForOverwrite<ModifiersC[]>(7);
+            REQUIRE(ModifiersC::count == 8);
+        }
+        REQUIRE(ModifiersC::count == 0);
+    }
+
+    SECTION("Writable") {
+        auto buffer = MakeSharedForOverwrite<char[], AtomicPolicy>(16);
+        std::memcpy(buffer.Get(), "hello", 6);
+        REQUIRE(std::string(buffer.Get()) == "hello");
+    }
+}
+
+struct CountingDeleter {
+    int* calls;
+
+    void operator()(int* ptr) const {
+        ++*calls;
+        delete ptr;
+    }
+};
+
+TEST_CASE("Custom deleters") {
+    SECTION("Stateless deleter takes no space") {
+        auto lambda = [](int* ptr) { delete ptr; };
+        static_assert(sizeof(CBlockDeleter<int, SingleThreadPolicy, decltype(lambda)>) ==
+                      sizeof(CBlockPtr<int, SingleThreadPolicy>));
+        static_assert(sizeof(CBlockDeleter<int, SingleThreadPolicy, CountingDeleter>) >
+                      sizeof(CBlockPtr<int, SingleThreadPolicy>));
+    }
+
+    SECTION("One allocation") {
+        int value = 42;
+        EXPECT_ONE_ALLOCATION(SharedPtr<int> sp(&value, [](int*) {}); REQUIRE(*sp == 42));
+    }
+
+    SECTION("Called once, by the last owner") {
+        int calls = 0;
+        {
+            SharedPtr<int> sp(new int(1), CountingDeleter{&calls});
+            SharedPtr<int> copy = sp;
+            sp.Reset();
+            REQUIRE(calls == 0);
+        }
+        REQUIRE(calls == 1);
+    }
+
+    SECTION("Reset") {
+        int calls = 0;
+        SharedPtr<int> sp(new int(1), CountingDeleter{&calls});
+        sp.Reset(new int(2), CountingDeleter{&calls});
+        REQUIRE(calls == 1);
+        REQUIRE(*sp == 2);
+        sp.Reset();
+        REQUIRE(calls == 2);
+    }
+
+    SECTION("Non-heap resources") {
+        bool closed = false;
+        {
+            char buffer[16];
+            SharedPtr<char, AtomicPolicy> sp(buffer, [&closed](char*) { closed = true; });
+            SharedPtr<char, AtomicPolicy> copy = sp;
+        }
+        REQUIRE(closed);
+    }
+
+    SECTION("Arrays") {
+        ModifiersC::count = 0;
+        {
+            SharedPtr<ModifiersC[]> sp(new ModifiersC[3], [](ModifiersC* ptr) { delete[] ptr; });
+            REQUIRE(ModifiersC::count == 3);
+        }
+        REQUIRE(ModifiersC::count == 0);
+    }
+}
+
+TEST_CASE("Moves do not count") {
+    static_assert(std::is_nothrow_move_constructible_v<SharedPtr<int>>);
+    static_assert(std::is_nothrow_move_assignable_v<SharedPtr<int, AtomicPolicy>>);
+    static_assert(kIsTriviallyRelocatable<SharedPtr<std::string>>);
+
+    auto sp = MakeShared<int>(1);
+    std::vector<SharedPtr<int>> v;
+    for (int i = 0; i < 100; ++i) {
+        v.push_back(sp);
+    }
+    REQUIRE(sp.UseCount() == 101);
+
+    SharedPtr<int> moved = std::move(v.back());
+    v.back() = std::move(moved);
+    v.back() = std::move(v.back());
+    REQUIRE(v.back().Get() == sp.Get());
+    REQUIRE(sp.UseCount() == 101);
+}
+
+using SlabPolicyC = SlabPolicy<SingleThreadPolicy>;
+using SlabSp = SharedPtr<ModifiersC, SlabPolicyC>;
+
+template <typename T>
+void MakeSlabShared(std::vector<SharedPtr<T, SlabPolicyC>>* out, size_t n) {
+    for (size_t i = 0; i < n; ++i) {
+        out->push_back(MakeShared<T, SlabPolicyC>());
+    }
+}
+
+TEST_CASE("Slab control blocks") {
+    SECTION("No malloc after reserve") {
+        ReserveControlBlocks<int, SlabPolicyC>(1000);
+        std::vector<SharedPtr<int, SlabPolicyC>> pointers;
+        pointers.reserve(1000);
+        EXPECT_ZERO_ALLOCATIONS(MakeSlabShared(&pointers, 1000));
+        pointers.clear();
+        EXPECT_ZERO_ALLOCATIONS(MakeSlabShared(&pointers, 1000));
+    }
+
+    SECTION("Raw pointers") {
+        ModifiersC::count = 0;
+        ReserveControlBlocks<void, SlabPolicyC>(1);
+        auto obj = new ModifiersC;
+        SlabSp sp;
+        EXPECT_ZERO_ALLOCATIONS(sp = SlabSp(obj));
+        REQUIRE(sp.Get() == obj);
+        sp.Reset();
+        REQUIRE(ModifiersC::count == 0);
+    }
+
+    SECTION("Every kind of block") {
+        ModifiersC::count = 0;
+        {
+            auto a = MakeShared<ModifiersC, SlabPolicyC>();
+            SharedPtr<ModifiersC, SlabPolicyC> b(new ModifiersC);
+            auto c = MakeShared<ModifiersC[], SlabPolicyC>(5);
+            auto d = MakeShared<ModifiersC[], SlabPolicyC>(100);
+            auto e = MakeShared<std::string, SlabPolicy<AtomicPolicy>>(1000, 'x');
+            SharedPtr<ModifiersC, SlabPolicyC> f = a;
+            REQUIRE(ModifiersC::count == 107);
+            REQUIRE(f.UseCount() == 2);
+            REQUIRE(e->size() == 1000);
+        }
+        REQUIRE(ModifiersC::count == 0);
+    }
+
+    SECTION("Alignment") {
+        auto sp = MakeShared<OverAligned, SlabPolicyC>();
+        REQUIRE(reinterpret_cast<uintptr_t>(sp.Get()) % 64 == 0);
+        auto doubles = MakeShared<long double, SlabPolicyC>();
+        REQUIRE(reinterpret_cast<uintptr_t>(doubles.Get()) % alignof(long double) == 0);
+    }
+}
+
+struct DeferredNode {
+    SharedPtr<DeferredNode, DeferredPolicy<>> next;
+    ModifiersC payload;
+};
+
+TEST_CASE("Deferred destruction") {
+    SECTION("Released on drain") {
+        ModifiersC::count = 0;
+        DrainReclaimQueue();
+        {
+            auto sp = MakeShared<ModifiersC, DeferredPolicy<>>();
+            SharedPtr<ModifiersC, DeferredPolicy<>> raw(new ModifiersC);
+            auto copy = sp;
+        }
+        REQUIRE(ModifiersC::count == 2);
+        REQUIRE(DrainReclaimQueue() == 2);
+        REQUIRE(ModifiersC::count == 0);
+        REQUIRE(DrainReclaimQueue() == 0);
+    }
+
+    SECTION("Whole graph") {
+        ModifiersC::count = 0;
+        {
+            SharedPtr<DeferredNode, DeferredPolicy<>> head;
+            for (int i = 0; i < 10000; ++i) {
+                auto node = MakeShared<DeferredNode, DeferredPolicy<>>();
+                node->next = std::move(head);
+                head = std::move(node);
+            }
+        }
+        REQUIRE(ModifiersC::count == 10000);
+        REQUIRE(DrainReclaimQueue() == 10000);
+        REQUIRE(ModifiersC::count == 0);
+    }
+
+    SECTION("Slab blocks") {
+        ModifiersC::count = 0;
+        MakeShared<ModifiersC, SlabPolicy<DeferredPolicy<SingleThreadPolicy>>>();
+        REQUIRE(ModifiersC::count == 1);
+        DrainReclaimQueue();
+        REQUIRE(ModifiersC::count == 0);
+    }
+}
+
+TEST_CASE("MakeSharedIsolated") {
+    ModifiersC::count = 0;
+    {
+        SharedPtr<ModifiersC> sp;
+        EXPECT_ONE_ALLOCATION(sp = MakeSharedIsolated<ModifiersC>());
+        REQUIRE(reinterpret_cast<uintptr_t>(sp.Get()) % kCacheLineSize == 0);
+        static_assert(sizeof(CBlockIsolated<int, AtomicPolicy>) == 2 * kCacheLineSize);
+        SharedPtr<ModifiersC> copy = sp;
+        REQUIRE(sp.UseCount() == 2);
+        REQUIRE(ModifiersC::count == 1);
+    }
+    REQUIRE(ModifiersC::count == 0);
+
+    auto str = MakeSharedIsolated<std::string, AtomicPolicy>(3, 'x');
+    REQUIRE(*str == "xxx");
+}
+
+struct GraphNode {
+    CompressedSharedPtr<GraphNode> left;
+    CompressedSharedPtr<GraphNode> right;
+    ModifiersC payload;
+};
+
+static_assert(sizeof(CompressedSharedPtr<GraphNode>) == sizeof(uint32_t));
+
+TEST_CASE("CompressedSharedPtr") {
+    SECTION("Basics") {
+        ModifiersC::count = 0;
+        CompressedSharedPtr<GraphNode> empty;
+        REQUIRE(!empty);
+        REQUIRE(empty.Get() == nullptr);
+        REQUIRE(empty.UseCount() == 0);
+        {
+            auto root = MakeCompressedShared<GraphNode>();
+            REQUIRE(CompressedArena::Contains(root.Get()));
+            root->left = MakeCompressedShared<GraphNode>();
+            root->right = root->left;
+            REQUIRE(root->left == root->right);
+            REQUIRE(root->left.UseCount() == 2);
+            REQUIRE(ModifiersC::count == 2);
+
+            auto moved = std::move(root);
+            REQUIRE(!root);
+            root.Swap(moved);
+            REQUIRE(root->left.UseCount() == 2);
+        }
+        REQUIRE(ModifiersC::count == 0);
+    }
+
+    SECTION("No malloc once warm") {
+        std::vector<CompressedSharedPtr<int>> pointers;
+        pointers.reserve(1000);
+        for (int i = 0; i < 1000; ++i) {
+            pointers.push_back(MakeCompressedShared<int>(i));
+        }
+        pointers.clear();
+        EXPECT_ZERO_ALLOCATIONS(for (int i = 0; i < 1000; ++i) {
+            pointers.push_back(MakeCompressedShared<int>(i));
+        });
+        REQUIRE(*pointers.back() == 999);
+    }
+
+    SECTION("Large objects") {
+        auto str = MakeCompressedShared<std::string, AtomicPolicy>(1000, 'x');
+        auto big = MakeCompressedShared<std::array<char, 4096>>();
+        REQUIRE(str->size() == 1000);
+        REQUIRE(CompressedArena::Contains(big.Get()));
+        auto doubles = MakeCompressedShared<long double>(1.5);
+        REQUIRE(reinterpret_cast<uintptr_t>(doubles.Get()) % alignof(long double) == 0);
+    }
+
+    SECTION("To SharedPtr") {
+        ModifiersC::count = 0;
+        SharedPtr<ModifiersC> wide;
+        {
+            auto node = MakeCompressedShared<ModifiersC>();
+            wide = node;
+            REQUIRE(wide.Get() == node.Get());
+            REQUIRE(node.UseCount() == 2);
+        }
+        REQUIRE(ModifiersC::count == 1);
+        wide.Reset();
+        REQUIRE(ModifiersC::count == 0);
+    }
+}
+
+TEST_CASE("Cow") {
+    SECTION("Copies share until written") {
+        Cow<std::string> a = std::string(100, 'a');
+        const std::string* original = &*a;
+        Cow<std::string> b = a;
+        REQUIRE(&*b == original);
+        REQUIRE(a.IsShared());
+        REQUIRE(a == b);
+
+        b.Write()[0] = 'b';
+        REQUIRE(&*b != original);
+        REQUIRE(&*a == original);
+        REQUIRE(a.Read() == std::string(100, 'a'));
+        REQUIRE(b->front() == 'b');
+        REQUIRE(!a.IsShared());
+        REQUIRE(!(a == b));
+    }
+
+    SECTION("Sole owner writes in place") {
+        auto map = MakeCow<std::map<int, int>>();
+        map.Write()[1] = 1;
+        const auto* address = &*map;
+        EXPECT_ZERO_ALLOCATIONS(map.Write()[1] = 2);
+        REQUIRE(&*map == address);
+        REQUIRE(map->at(1) == 2);
+    }
+
+    SECTION("Copies do not allocate") {
+        Cow<std::vector<int>> vec = std::vector<int>(1000, 7);
+        std::vector<Cow<std::vector<int>>> copies;
+        copies.reserve(10);
+        EXPECT_ZERO_ALLOCATIONS(for (int i = 0; i < 10; ++i) { copies.push_back(vec); });
+        REQUIRE(vec.UseCount() == 11);
+        copies[3].Write().push_back(8);
+        REQUIRE(vec.UseCount() == 10);
+        REQUIRE(copies[3]->size() == 1001);
+        REQUIRE(vec->size() == 1000);
+    }
+
+    SECTION("Moves and swaps") {
+        Cow<std::string> a = std::string("a");
+        Cow<std::string> b = std::string("b");
+        a.Swap(b);
+        REQUIRE(*a == "b");
+        Cow<std::string> c = std::move(a);
+        REQUIRE(*c == "b");
+        a = b;
+        REQUIRE(*a == "a");
+        REQUIRE(a.UseCount() == 2);
+    }
+}
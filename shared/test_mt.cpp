@@ -0,0 +1,244 @@
+#include "shared.h"
+#include "biased.h"
+
+#include <catch.hpp>
+
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+struct Counted {
+    static inline std::atomic<int> alive = 0;
+    static inline std::atomic<int> destroyed = 0;
+
+    Counted() {
+        ++alive;
+    }
+
+    ~Counted() {
+        --alive;
+        ++destroyed;
+    }
+
+    int value = 42;
+};
+
+constexpr int kNumThreads = 8;
+constexpr int kNumIters = 100000;
+
+TEST_CASE("Policy is a part of the type") {
+    static_assert(std::is_same_v<SharedPtr<int>, SharedPtr<int, SingleThreadPolicy>>);
+    static_assert(!std::is_convertible_v<SharedPtr<int>, SharedPtr<int, AtomicPolicy>>);
+    static_assert(!std::is_convertible_v<SharedPtr<int, AtomicPolicy>, SharedPtr<int>>);
+}
+
+TEMPLATE_TEST_CASE("Concurrent copies", "", AtomicPolicy, PackedAtomicPolicy, BiasedPolicy,
+                   SlabPolicy<AtomicPolicy>) {
+    using MtSharedPtr = SharedPtr<Counted, TestType>;
+
+    Counted::destroyed = 0;
+    SECTION("MakeShared") {
+        MtSharedPtr sp = MakeShared<Counted, TestType>();
+        std::atomic<int> broken = 0;
+        std::vector<std::thread> threads;
+        for (int i = 0; i < kNumThreads; ++i) {
+            threads.emplace_back([&sp, &broken] {
+                for (int j = 0; j < kNumIters; ++j) {
+                    MtSharedPtr copy = sp;
+                    MtSharedPtr moved = std::move(copy);
+                    if (moved->value != 42) {
+                        ++broken;
+                    }
+                }
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        REQUIRE(broken == 0);
+        REQUIRE(sp.UseCount() == 1);
+    }
+
+    SECTION("Raw pointer") {
+        MtSharedPtr sp(new Counted);
+        std::vector<std::thread> threads;
+        for (int i = 0; i < kNumThreads; ++i) {
+            threads.emplace_back([&sp] {
+                std::vector<MtSharedPtr> copies(16, sp);
+                for (int j = 0; j < kNumIters; ++j) {
+                    copies[j % copies.size()] = sp;
+                }
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        REQUIRE(sp.UseCount() == 1);
+    }
+    REQUIRE(Counted::alive == 0);
+    REQUIRE(Counted::destroyed == 1);
+}
+
+TEMPLATE_TEST_CASE("Last owner destroys once", "", AtomicPolicy, PackedAtomicPolicy,
+                   SlabPolicy<AtomicPolicy>) {
+    Counted::destroyed = 0;
+    constexpr int kNumObjects = 1000;
+    for (int i = 0; i < kNumObjects; ++i) {
+        SharedPtr<Counted, TestType> sp = MakeShared<Counted, TestType>();
+        std::vector<std::thread> threads;
+        for (int j = 0; j < 4; ++j) {
+            threads.emplace_back([copy = sp]() mutable { copy.Reset(); });
+        }
+        sp.Reset();
+        for (auto& thread : threads) {
+            thread.join();
+        }
+    }
+    REQUIRE(Counted::alive == 0);
+    REQUIRE(Counted::destroyed == kNumObjects);
+}
+
+TEST_CASE("Biased handoff") {
+    Counted::destroyed = 0;
+
+    SECTION("Foreign thread drops the only reference") {
+        auto sp = MakeShared<Counted, BiasedPolicy>();
+        std::thread([sp = std::move(sp)]() mutable { sp.Reset(); }).join();
+        REQUIRE(Counted::alive == 1);
+        BiasedPolicy::MergeQueued();
+        REQUIRE(Counted::alive == 0);
+    }
+
+    SECTION("Owner thread exits first") {
+        SharedPtr<Counted, BiasedPolicy> sp;
+        std::thread([&sp] {
+            sp = MakeShared<Counted, BiasedPolicy>();
+            SharedPtr<Counted, BiasedPolicy> copy = sp;
+        }).join();
+        REQUIRE(sp.UseCount() == 1);
+        sp.Reset();
+        REQUIRE(Counted::alive == 0);
+    }
+
+    SECTION("Owner merges on its next release") {
+        auto sp = MakeShared<Counted, BiasedPolicy>();
+        std::thread([copy = sp]() mutable { copy.Reset(); }).join();
+        {
+            SharedPtr<Counted, BiasedPolicy> other(new Counted);
+        }
+        REQUIRE(sp.UseCount() == 1);
+        sp.Reset();
+        REQUIRE(Counted::alive == 0);
+    }
+
+    SECTION("Producer and consumers") {
+        std::vector<SharedPtr<Counted, BiasedPolicy>> produced(kNumIters / 10);
+        std::thread producer([&produced] {
+            for (auto& sp : produced) {
+                sp = MakeShared<Counted, BiasedPolicy>();
+            }
+        });
+        producer.join();
+
+        std::vector<std::thread> consumers;
+        for (int i = 0; i < kNumThreads; ++i) {
+            consumers.emplace_back([&produced, i] {
+                for (size_t j = i; j < produced.size(); j += kNumThreads) {
+                    SharedPtr<Counted, BiasedPolicy> copy = produced[j];
+                    produced[j].Reset();
+                }
+            });
+        }
+        for (auto& thread : consumers) {
+            thread.join();
+        }
+    }
+    REQUIRE(Counted::alive == 0);
+}
+
+TEST_CASE("Slab blocks change threads") {
+    using SlabSharedPtr = SharedPtr<Counted, SlabPolicy<AtomicPolicy>>;
+    Counted::destroyed = 0;
+    std::vector<SlabSharedPtr> produced(kNumIters);
+    std::thread([&produced] {
+        ReserveControlBlocks<Counted, SlabPolicy<AtomicPolicy>>(kNumIters / 10);
+        for (auto& sp : produced) {
+            sp = MakeShared<Counted, SlabPolicy<AtomicPolicy>>();
+        }
+    }).join();
+
+    std::vector<std::thread> consumers;
+    for (int i = 0; i < kNumThreads; ++i) {
+        consumers.emplace_back([&produced, i] {
+            for (size_t j = i; j < produced.size(); j += kNumThreads) {
+                produced[j].Reset();
+                produced[j] = MakeShared<Counted, SlabPolicy<AtomicPolicy>>();
+            }
+        });
+    }
+    for (auto& thread : consumers) {
+        thread.join();
+    }
+    REQUIRE(Counted::alive == kNumIters);
+    produced.clear();
+    REQUIRE(Counted::alive == 0);
+    REQUIRE(Counted::destroyed == 2 * kNumIters);
+}
+
+TEST_CASE("Background reclaimer") {
+    using DeferredSharedPtr = SharedPtr<Counted, DeferredPolicy<AtomicPolicy>>;
+    Counted::destroyed = 0;
+    {
+        BackgroundReclaimer reclaimer(std::chrono::microseconds(100));
+        std::vector<std::thread> threads;
+        for (int i = 0; i < kNumThreads; ++i) {
+            threads.emplace_back([] {
+                for (int j = 0; j < kNumIters / kNumThreads; ++j) {
+                    DeferredSharedPtr sp = MakeShared<Counted, DeferredPolicy<AtomicPolicy>>();
+                    DeferredSharedPtr copy = sp;
+                }
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+    }
+    REQUIRE(Counted::alive == 0);
+    REQUIRE(Counted::destroyed == kNumIters / kNumThreads * kNumThreads);
+}
+
+TEST_CASE("Expiry hooks race with unlinking") {
+    using ObservedPtr = SharedPtr<Counted, ObservablePolicy<AtomicPolicy>>;
+    struct Hook : ExpiryHook {
+        Hook() : ExpiryHook(&Mark) {
+        }
+
+        static void Mark(ExpiryHook* hook) {
+            static_cast<Hook*>(hook)->fired = true;
+        }
+
+        bool fired = false;
+    };
+
+    Counted::destroyed = 0;
+    std::atomic<int> fired = 0;
+    for (int i = 0; i < kNumIters / 10; ++i) {
+        ObservedPtr sp = MakeShared<Counted, ObservablePolicy<AtomicPolicy>>();
+        auto hook = std::make_unique<Hook>();
+        sp.OnExpire(hook.get());
+        // Destroying the hook right after Unlink is safe even if its callback was running.
+        std::thread unlinker([&hook, &fired] {
+            hook->Unlink();
+            fired += hook->fired;
+            hook.reset();
+        });
+        sp.Reset();
+        unlinker.join();
+    }
+    REQUIRE(Counted::alive == 0);
+    REQUIRE(Counted::destroyed == kNumIters / 10);
+    REQUIRE(fired <= kNumIters / 10);
+}
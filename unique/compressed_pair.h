@@ -206,3 +206,17 @@ private:
     F first_;
     F second_;
 };
+
+// Uninitialized memory for a T that is constructed in place later. Copying it copies nothing,
+// so it can be passed into a CompressedPair constructor for free.
+template <typename T>
+struct RawStorage {
+    RawStorage(){};
+    RawStorage(const RawStorage&){};
+
+    T* Get() {
+        return reinterpret_cast<T*>(bytes);
+    }
+
+    alignas(T) unsigned char bytes[sizeof(T)];
+};
@@ -3,6 +3,7 @@
 #include "deleters.h"
 
 #include <common/my_int.h>
+#include <common/tracking_allocator.h>
 
 #include <catch.hpp>
 #include <vector>
@@ -505,3 +506,62 @@ TEST_CASE("Upcasts") {
         s2 = std::move(s);
     }
 }
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+TEST_CASE("Trivially relocatable") {
+    static_assert(kIsTriviallyRelocatable<UniquePtr<int>>);
+    static_assert(kIsTriviallyRelocatable<UniquePtr<int[]>>);
+    static_assert(!kIsTriviallyRelocatable<UniquePtr<int, Deleter<int>>>);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+TEST_CASE("AllocateUnique") {
+    SECTION("Goes through the allocator") {
+        AllocationStats stats;
+        int alive = MyInt::AliveCount();
+        {
+            auto up = AllocateUnique<MyInt>(TrackingAllocator<MyInt>(&stats), 42);
+            REQUIRE(*up == 42);
+            REQUIRE(MyInt::AliveCount() == alive + 1);
+            REQUIRE(stats.allocations == 1);
+        }
+        REQUIRE(MyInt::AliveCount() == alive);
+        REQUIRE(stats.deallocations == 1);
+    }
+
+    SECTION("Empty allocator takes no space") {
+        static_assert(sizeof(UniquePtr<int, AllocatorDeleter<int, std::allocator<int>>>) ==
+                      sizeof(int*));
+        auto up = AllocateUnique<std::string>(std::allocator<char>(), "abc");
+        REQUIRE(*up == "abc");
+    }
+
+    SECTION("Move and reset") {
+        AllocationStats stats;
+        TrackingAllocator<int> alloc(&stats);
+        auto a = AllocateUnique<int>(alloc, 1);
+        auto b = std::move(a);
+        REQUIRE(a.Get() == nullptr);
+        REQUIRE(*b == 1);
+        b.Reset();
+        REQUIRE(stats.deallocations == 1);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+TEST_CASE("Deferred deleter") {
+    int alive = MyInt::AliveCount();
+    {
+        UniquePtr<MyInt, DeferredDeleter<MyInt>> up(new MyInt(1));
+        UniquePtr<MyInt[], DeferredDeleter<MyInt[]>> array(new MyInt[3]);
+        up.Reset(new MyInt(2));
+        REQUIRE(MyInt::AliveCount() == alive + 5);
+    }
+    REQUIRE(MyInt::AliveCount() == alive + 5);
+    REQUIRE(DrainReclaimQueue() == 3);
+    REQUIRE(MyInt::AliveCount() == alive);
+    static_assert(sizeof(UniquePtr<MyInt, DeferredDeleter<MyInt>>) == sizeof(MyInt*));
+}
@@ -2,6 +2,9 @@
 
 #include "compressed_pair.h"
 
+#include <common/reclaim_queue.h>
+#include <common/relocatable.h>
+
 #include <cstddef>
 #include <memory>
 
@@ -35,6 +38,52 @@ struct MyCustomDeleter<T[]> {
     ~MyCustomDeleter() = default;
 };
 
+// UniquePtr<T, DeferredDeleter<T>>: instead of deleting the object, queues it for
+// DrainReclaimQueue(), which runs a default-constructed D on it.
+template <typename T, typename D = MyCustomDeleter<T>>
+struct DeferredDeleter {
+    DeferredDeleter() = default;
+
+    template <typename U, typename E>
+    DeferredDeleter(const DeferredDeleter<U, E>&){};
+
+    template <typename U>
+    void operator()(U* obj) const {
+        if (obj != nullptr) {
+            ReclaimQueue::Defer(&Reclaim<U>, obj);
+        }
+    }
+
+    template <typename U>
+    static void Reclaim(void* obj) {
+        D deleter;
+        deleter(static_cast<U*>(obj));
+    }
+};
+
+// Destroys and frees an object created by AllocateUnique. It derives from the allocator, so
+// with an empty allocator the deleter is empty too and CompressedPair stores nothing for it.
+template <typename T, typename Alloc>
+struct AllocatorDeleter : private std::allocator_traits<Alloc>::template rebind_alloc<T> {
+    using Traits = typename std::allocator_traits<Alloc>::template rebind_traits<T>;
+    using Allocator = typename Traits::allocator_type;
+
+    AllocatorDeleter() = default;
+    AllocatorDeleter(const Alloc& alloc) : Allocator(alloc){};
+
+    void operator()(T* obj) {
+        if (obj != nullptr) {
+            Allocator& alloc = *this;
+            Traits::destroy(alloc, obj);
+            Traits::deallocate(alloc, obj, 1);
+        }
+    }
+
+    const Allocator& GetAllocator() const {
+        return *this;
+    }
+};
+
 
 
 template <typename T, typename Deleter = MyCustomDeleter<T>>
@@ -190,3 +239,22 @@ public:
 private:
     CompressedPair<T*, Deleter> cp_;
 };
+
+// Only the deleter may keep a pointer to itself.
+template <typename T, typename Deleter>
+struct IsTriviallyRelocatable<UniquePtr<T, Deleter>> : IsTriviallyRelocatable<Deleter> {};
+
+template <typename T, typename Alloc, typename... Args>
+UniquePtr<T, AllocatorDeleter<T, Alloc>> AllocateUnique(const Alloc& alloc, Args&&... args) {
+    AllocatorDeleter<T, Alloc> deleter(alloc);
+    using Traits = typename AllocatorDeleter<T, Alloc>::Traits;
+    typename Traits::allocator_type obj_alloc(alloc);
+    T* obj = Traits::allocate(obj_alloc, 1);
+    try {
+        Traits::construct(obj_alloc, obj, std::forward<Args>(args)...);
+    } catch (...) {
+        Traits::deallocate(obj_alloc, obj, 1);
+        throw;
+    }
+    return UniquePtr<T, AllocatorDeleter<T, Alloc>>(obj, std::move(deleter));
+}
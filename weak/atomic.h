@@ -0,0 +1,187 @@
+#pragma once
+
+#include "shared.h"
+#include "weak.h"
+
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <utility>
+
+// AtomicSharedPtr<T> and AtomicWeakPtr<T>: a SharedPtr / WeakPtr that many threads may load and
+// store concurrently, like std::atomic<std::shared_ptr<T>>.
+//
+// The stored pointer lives in an immutable heap node, and the slot is a single 64-bit word with
+// the node address in the low 48 bits and a count of readers that are copying out of it in the
+// high 16 bits (the split reference count). A reader bumps that count with one fetch_add, copies
+// the pointer from the node and then takes its bump back, or, if the slot moved on in between,
+// releases the node instead. A writer that swaps a node out transfers the readers still counted
+// in the old word to the node itself, so the node stays alive until the last of them is done.
+// Nobody ever takes a lock, and every Store allocates a new node.
+//
+// Requires user-space addresses to fit into 48 bits (x86-64 and AArch64 with the default
+// virtual address size) and fewer than 65536 threads inside Load at the same time. The pointers
+// must use a thread-safe policy, e.g. AtomicPolicy.
+
+template <typename Handle>
+class AtomicSlot {
+public:
+    AtomicSlot() = default;
+
+    explicit AtomicSlot(Handle desired) : word_(Pack(MakeNode(std::move(desired)))) {
+    }
+
+    AtomicSlot(const AtomicSlot&) = delete;
+    AtomicSlot& operator=(const AtomicSlot&) = delete;
+
+    ~AtomicSlot() {
+        Retire(word_.load(std::memory_order_acquire));
+    }
+
+    Handle Load() const {
+        Node* node = Pin();
+        if (node == nullptr) {
+            return Handle();
+        }
+        Handle result = node->value;
+        Unpin(node);
+        return result;
+    }
+
+    void Store(Handle desired) {
+        Retire(word_.exchange(Pack(MakeNode(std::move(desired))), std::memory_order_acq_rel));
+    }
+
+    Handle Exchange(Handle desired) {
+        uint64_t old =
+            word_.exchange(Pack(MakeNode(std::move(desired))), std::memory_order_acq_rel);
+        Node* node = Ptr(old);
+        // The node is ours until Retire hands it over to its readers.
+        Handle result = node ? node->value : Handle();
+        Retire(old);
+        return result;
+    }
+
+    // Stores desired if the slot holds the same pointer with the same owner as expected.
+    // Otherwise loads the current value into expected and returns false.
+    bool CompareExchange(Handle& expected, Handle desired) {
+        Node* fresh = nullptr;
+        while (true) {
+            Node* node = Pin();
+            if (node ? !Same(node->value, expected) : !Same(Handle(), expected)) {
+                expected = node ? node->value : Handle();
+                Unpin(node);
+                delete fresh;
+                return false;
+            }
+            if (fresh == nullptr) {
+                fresh = MakeNode(std::move(desired));
+            }
+            uint64_t cur = word_.load(std::memory_order_relaxed);
+            while (Ptr(cur) == node) {
+                if (word_.compare_exchange_weak(cur, Pack(fresh), std::memory_order_acq_rel,
+                                                std::memory_order_relaxed)) {
+                    Retire(cur);
+                    Unpin(node);
+                    return true;
+                }
+            }
+            // Somebody else stored in between, compare against the new value.
+            Unpin(node);
+        }
+    }
+
+private:
+    struct Node {
+        explicit Node(Handle value) : value(std::move(value)) {
+        }
+
+        // Readers transferred by the writer minus readers that gave up; zero means unused.
+        std::atomic<int64_t> refs = 0;
+        const Handle value;
+    };
+
+    static constexpr int kPtrBits = 48;
+    static constexpr uint64_t kPtrMask = (uint64_t(1) << kPtrBits) - 1;
+    static constexpr uint64_t kOneReader = uint64_t(1) << kPtrBits;
+
+    static_assert(sizeof(void*) == sizeof(uint64_t));
+
+    static Node* MakeNode(Handle value) {
+        if (value.block_ == nullptr && value.ptr_ == nullptr) {
+            return nullptr;
+        }
+        return new Node(std::move(value));
+    }
+
+    static uint64_t Pack(Node* node) {
+        auto word = reinterpret_cast<uint64_t>(node);
+        assert((word & ~kPtrMask) == 0);
+        return word;
+    }
+
+    static Node* Ptr(uint64_t word) {
+        return reinterpret_cast<Node*>(word & kPtrMask);
+    }
+
+    static uint64_t Readers(uint64_t word) {
+        return word >> kPtrBits;
+    }
+
+    static bool Same(const Handle& left, const Handle& right) {
+        return left.ptr_ == right.ptr_ && left.block_ == right.block_;
+    }
+
+    // An empty slot has nothing to protect, so readers never take their count back from it:
+    // an empty word may be stored again later, and taking it back then would hit somebody
+    // else's count. The garbage there is dropped by the next writer, and it overflows off
+    // the top of the word rather than into the pointer.
+    Node* Pin() const {
+        return Ptr(word_.fetch_add(kOneReader, std::memory_order_acquire));
+    }
+
+    void Unpin(Node* node) const {
+        if (node == nullptr) {
+            return;
+        }
+        // A node is never stored twice and cannot be freed while we are counted, so the
+        // pointer comparison is not fooled by a reused address.
+        uint64_t cur = word_.load(std::memory_order_relaxed);
+        while (Ptr(cur) == node) {
+            if (word_.compare_exchange_weak(cur, cur - kOneReader, std::memory_order_release,
+                                            std::memory_order_relaxed)) {
+                return;
+            }
+        }
+        // The writer has moved our count to the node.
+        if (node->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            delete node;
+        }
+    }
+
+    // Releases the slot's node taken out of the word, once the readers counted there are done.
+    static void Retire(uint64_t word) {
+        Node* node = Ptr(word);
+        if (node == nullptr) {
+            return;
+        }
+        auto readers = static_cast<int64_t>(Readers(word));
+        if (node->refs.fetch_add(readers, std::memory_order_acq_rel) == -readers) {
+            delete node;
+        }
+    }
+
+    mutable std::atomic<uint64_t> word_ = 0;
+};
+
+template <typename T, typename Policy = AtomicPolicy>
+class AtomicSharedPtr : public AtomicSlot<SharedPtr<T, Policy>> {
+public:
+    using AtomicSlot<SharedPtr<T, Policy>>::AtomicSlot;
+};
+
+template <typename T, typename Policy = AtomicPolicy>
+class AtomicWeakPtr : public AtomicSlot<WeakPtr<T, Policy>> {
+public:
+    using AtomicSlot<WeakPtr<T, Policy>>::AtomicSlot;
+};
@@ -0,0 +1,76 @@
+#include "shared.h"
+#include "weak.h"
+#include "atomic.h"
+
+#include <benchmark/benchmark.h>
+
+#include <mutex>
+#include <string>
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// A configuration object that many threads read and somebody occasionally replaces.
+
+struct Config {
+    std::string name = "config";
+    int version = 0;
+};
+
+using ConfigPtr = SharedPtr<Config, AtomicPolicy>;
+
+class MutexSlot {
+public:
+    explicit MutexSlot(ConfigPtr desired) : value_(std::move(desired)) {
+    }
+
+    ConfigPtr Load() const {
+        std::lock_guard lock(mutex_);
+        return value_;
+    }
+
+    void Store(ConfigPtr desired) {
+        std::lock_guard lock(mutex_);
+        value_.Swap(desired);
+    }
+
+private:
+    mutable std::mutex mutex_;
+    ConfigPtr value_;
+};
+
+template <typename Slot>
+Slot& SharedSlot() {
+    static Slot slot(MakeShared<Config, AtomicPolicy>());
+    return slot;
+}
+
+template <typename Slot>
+void BM_Load(benchmark::State& state) {
+    Slot& slot = SharedSlot<Slot>();
+    for (auto _ : state) {
+        ConfigPtr config = slot.Load();
+        benchmark::DoNotOptimize(config->version);
+    }
+}
+
+// Thread 0 keeps replacing the value while the others read it.
+template <typename Slot>
+void BM_LoadStore(benchmark::State& state) {
+    Slot& slot = SharedSlot<Slot>();
+    int version = 0;
+    for (auto _ : state) {
+        if (state.thread_index() == 0 && ++version % 64 == 0) {
+            auto config = MakeShared<Config, AtomicPolicy>();
+            config->version = version;
+            slot.Store(std::move(config));
+        } else {
+            ConfigPtr config = slot.Load();
+            benchmark::DoNotOptimize(config->version);
+        }
+    }
+}
+
+BENCHMARK_TEMPLATE(BM_Load, AtomicSharedPtr<Config>)->ThreadRange(1, 64)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_Load, MutexSlot)->ThreadRange(1, 64)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_LoadStore, AtomicSharedPtr<Config>)->ThreadRange(1, 64)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_LoadStore, MutexSlot)->ThreadRange(1, 64)->UseRealTime();
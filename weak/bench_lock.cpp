@@ -0,0 +1,55 @@
+#include "shared.h"
+#include "weak.h"
+
+#include <benchmark/benchmark.h>
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// Upgrading a weak pointer to an object that many threads share and keep alive.
+
+template <typename Policy>
+SharedPtr<int, Policy>& SharedObject() {
+    static SharedPtr<int, Policy> object = MakeShared<int, Policy>(42);
+    return object;
+}
+
+template <typename Policy>
+void BM_LockAlive(benchmark::State& state) {
+    WeakPtr<int, Policy> weak = SharedObject<Policy>();
+    for (auto _ : state) {
+        auto sp = weak.Lock();
+        benchmark::DoNotOptimize(*sp);
+    }
+}
+
+// Polling an object that is already gone: Lock reads the control block every time,
+// LockOrReset only the first time.
+template <typename Policy>
+void BM_LockDead(benchmark::State& state) {
+    WeakPtr<int, Policy> weak;
+    {
+        auto sp = MakeShared<int, Policy>(42);
+        weak = sp;
+    }
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(weak.Lock());
+    }
+}
+
+template <typename Policy>
+void BM_LockOrResetDead(benchmark::State& state) {
+    WeakPtr<int, Policy> weak;
+    {
+        auto sp = MakeShared<int, Policy>(42);
+        weak = sp;
+    }
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(weak.LockOrReset());
+    }
+}
+
+BENCHMARK_TEMPLATE(BM_LockAlive, SingleThreadPolicy);
+BENCHMARK_TEMPLATE(BM_LockAlive, AtomicPolicy)->ThreadRange(1, 64)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_LockAlive, PackedAtomicPolicy)->ThreadRange(1, 64)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_LockDead, AtomicPolicy);
+BENCHMARK_TEMPLATE(BM_LockOrResetDead, AtomicPolicy);
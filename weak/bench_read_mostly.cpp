@@ -0,0 +1,59 @@
+#include "shared.h"
+#include "atomic.h"
+#include "read_mostly.h"
+
+#include <benchmark/benchmark.h>
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// Every request reads the current configuration. Copying one global SharedPtr makes all cores
+// write the same counter; ReadMostlySharedPtr readers only read shared memory, so the throughput
+// should grow with the number of threads.
+
+struct Config {
+    int version = 0;
+};
+
+using ConfigPtr = SharedPtr<Config, AtomicPolicy>;
+
+void BM_CopyGlobal(benchmark::State& state) {
+    static ConfigPtr global = MakeShared<Config, AtomicPolicy>();
+    for (auto _ : state) {
+        ConfigPtr config = global;
+        benchmark::DoNotOptimize(config->version);
+    }
+}
+
+void BM_AtomicLoad(benchmark::State& state) {
+    static AtomicSharedPtr<Config> global(MakeShared<Config, AtomicPolicy>());
+    for (auto _ : state) {
+        ConfigPtr config = global.Load();
+        benchmark::DoNotOptimize(config->version);
+    }
+}
+
+void BM_ReadMostly(benchmark::State& state) {
+    static ReadMostlySharedPtr<Config> global(MakeShared<Config, AtomicPolicy>());
+    for (auto _ : state) {
+        const ConfigPtr& config = global.Load();
+        benchmark::DoNotOptimize(config->version);
+    }
+}
+
+// Same, with thread 0 publishing a new snapshot every 4096 iterations.
+void BM_ReadMostlyWithWrites(benchmark::State& state) {
+    static ReadMostlySharedPtr<Config> global(MakeShared<Config, AtomicPolicy>());
+    int iteration = 0;
+    for (auto _ : state) {
+        if (state.thread_index() == 0 && ++iteration % 4096 == 0) {
+            global.Store(MakeShared<Config, AtomicPolicy>());
+        }
+        const ConfigPtr& config = global.Load();
+        benchmark::DoNotOptimize(config->version);
+    }
+}
+
+BENCHMARK(BM_CopyGlobal)->ThreadRange(1, 64)->UseRealTime();
+BENCHMARK(BM_AtomicLoad)->ThreadRange(1, 64)->UseRealTime();
+BENCHMARK(BM_ReadMostly)->ThreadRange(1, 64)->UseRealTime();
+BENCHMARK(BM_ReadMostlyWithWrites)->ThreadRange(1, 64)->UseRealTime();
@@ -0,0 +1,85 @@
+#include "shared.h"
+#include "weak_cache.h"
+
+#include <benchmark/benchmark.h>
+
+#include <cstdint>
+#include <memory>
+#include <random>
+#include <unordered_map>
+#include <vector>
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// A memoization cache in front of a working set that drifts: lookups pick random keys from a
+// range, and only the values of the last kLiveValues lookups are still held by somebody. The
+// std baseline is what we did so far, a map of std::weak_ptr swept for expired entries once
+// the map has grown by half. The slots counter is the table size at the end.
+
+constexpr size_t kLiveValues = 1024;
+
+struct Payload {
+    explicit Payload(int64_t key) : key(key) {
+    }
+
+    int64_t key;
+    int64_t data[6] = {};
+};
+
+class StdWeakCache {
+public:
+    std::shared_ptr<Payload> GetOrCreate(int64_t key) {
+        if (map_.size() >= swept_size_ + swept_size_ / 2 + kLiveValues) {
+            Sweep();
+        }
+        std::weak_ptr<Payload>& slot = map_[key];
+        if (auto value = slot.lock()) {
+            return value;
+        }
+        auto value = std::make_shared<Payload>(key);
+        slot = value;
+        return value;
+    }
+
+    size_t Size() const {
+        return map_.size();
+    }
+
+private:
+    void Sweep() {
+        for (auto it = map_.begin(); it != map_.end();) {
+            it = it->second.expired() ? map_.erase(it) : std::next(it);
+        }
+        swept_size_ = map_.size();
+    }
+
+    std::unordered_map<int64_t, std::weak_ptr<Payload>> map_;
+    size_t swept_size_ = 0;
+};
+
+template <typename Cache>
+void BM_GetOrCreate(benchmark::State& state) {
+    Cache cache;
+    std::mt19937_64 gen(42);
+    std::uniform_int_distribution<int64_t> keys(0, state.range(0) - 1);
+    std::vector<decltype(cache.GetOrCreate(0))> live(kLiveValues);
+    size_t next = 0;
+    for (auto _ : state) {
+        int64_t key = keys(gen);
+        auto value = cache.GetOrCreate(key, key);
+        benchmark::DoNotOptimize(value->key);
+        live[next++ % kLiveValues] = std::move(value);
+    }
+    state.counters["slots"] = cache.Size();
+}
+
+// GetOrCreate(key, key) for both, so the loop above needs no special case.
+class StdWeakCacheAdapter : public StdWeakCache {
+public:
+    std::shared_ptr<Payload> GetOrCreate(int64_t key, int64_t = 0) {
+        return StdWeakCache::GetOrCreate(key);
+    }
+};
+
+BENCHMARK_TEMPLATE(BM_GetOrCreate, WeakValueCache<int64_t, Payload>)->Range(1 << 12, 1 << 22);
+BENCHMARK_TEMPLATE(BM_GetOrCreate, StdWeakCacheAdapter)->Range(1 << 12, 1 << 22);
@@ -0,0 +1,123 @@
+#pragma once
+
+#include "shared.h"
+#include "weak.h"
+
+#include <common/cache_line.h>
+#include <common/expiry_hook.h>
+
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// InternPool<T>: hash-consing for immutable values. Intern(value) returns the canonical
+// SharedPtr<const T> of everything equal to value, so equal values share one allocation and
+// compare equal by pointer. The pool only holds weak references: every entry hangs an
+// ExpiryHook on its canonical, which drops the entry the moment the last owner lets go.
+//
+// The table is split into kNumShards shards by hash, each with its own mutex, so threads
+// interning different values rarely meet. T must be hashable, and must not change once
+// interned: the pointer is to const for a reason.
+
+template <typename T, typename Policy = ObservablePolicy<AtomicPolicy>,
+          typename Hash = std::hash<T>, typename KeyEqual = std::equal_to<T>>
+class InternPool {
+    static_assert(std::is_base_of_v<ExpiryList, Policy>, "InternPool needs ObservablePolicy");
+
+public:
+    static constexpr size_t kNumShards = 16;
+
+    InternPool() = default;
+
+    InternPool(const InternPool&) = delete;
+    InternPool& operator=(const InternPool&) = delete;
+
+    // Entries are unlinked outside the shard locks: unlinking waits for a callback that may be
+    // running right now, and the callback takes the lock.
+    ~InternPool() {
+        for (Shard& shard : shards_) {
+            std::vector<std::unique_ptr<Entry>> entries;
+            {
+                std::lock_guard lock(shard.mutex);
+                for (auto& [hash, entry] : shard.entries) {
+                    entries.push_back(std::move(entry));
+                }
+                shard.entries.clear();
+            }
+        }
+    }
+
+    SharedPtr<const T, Policy> Intern(T value) {
+        size_t hash = Hash()(value);
+        Shard& shard = shards_[hash % kNumShards];
+        // Canonicals locked only to compare are released after the lock: dropping the last
+        // reference runs the expiry callback, which takes the lock.
+        std::vector<SharedPtr<const T, Policy>> collisions;
+        std::lock_guard lock(shard.mutex);
+        auto [begin, end] = shard.entries.equal_range(hash);
+        for (auto it = begin; it != end; ++it) {
+            // A dead canonical may be destroyed already, so lock it before comparing.
+            SharedPtr<const T, Policy> canonical = it->second->weak.Lock();
+            if (canonical && KeyEqual()(*canonical, value)) {
+                return canonical;
+            }
+            collisions.push_back(std::move(canonical));
+        }
+        SharedPtr<const T, Policy> canonical = MakeShared<T, Policy>(std::move(value));
+        auto entry = std::make_unique<Entry>(&shard, hash, canonical);
+        canonical.OnExpire(entry.get());
+        shard.entries.emplace(hash, std::move(entry));
+        return canonical;
+    }
+
+    // Canonical values alive right now, give or take the ones whose callbacks are running.
+    size_t Size() const {
+        size_t size = 0;
+        for (const Shard& shard : shards_) {
+            std::lock_guard lock(shard.mutex);
+            size += shard.entries.size();
+        }
+        return size;
+    }
+
+private:
+    struct Shard;
+
+    struct Entry : ExpiryHook {
+        Entry(Shard* shard, size_t hash, const SharedPtr<const T, Policy>& canonical)
+            : ExpiryHook(&Drop), shard(shard), hash(hash), weak(canonical) {
+        }
+
+        // Takes the entry out of its shard, unless the pool took it out first.
+        static void Drop(ExpiryHook* hook) {
+            auto self = static_cast<Entry*>(hook);
+            std::unique_ptr<Entry> owned;
+            {
+                std::lock_guard lock(self->shard->mutex);
+                auto [begin, end] = self->shard->entries.equal_range(self->hash);
+                for (auto it = begin; it != end; ++it) {
+                    if (it->second.get() == self) {
+                        owned = std::move(it->second);
+                        self->shard->entries.erase(it);
+                        break;
+                    }
+                }
+            }
+        }
+
+        Shard* shard;
+        size_t hash;
+        WeakPtr<const T, Policy> weak;
+    };
+
+    struct alignas(kCacheLineSize) Shard {
+        mutable std::mutex mutex;
+        std::unordered_multimap<size_t, std::unique_ptr<Entry>> entries;
+    };
+
+    Shard shards_[kNumShards];
+};
@@ -0,0 +1,165 @@
+#pragma once
+
+#include "shared.h"
+
+#include <common/cache_line.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+// ReadMostlySharedPtr<T>: a SharedPtr that is read on every request and replaced rarely, such as
+// a configuration snapshot.
+//
+// Every reader thread keeps its own copy of the pointer in a slot on a cache line of its own,
+// tagged with the version it was copied at. Load compares that tag with the current version and
+// returns the cached copy, so in the steady state a read only loads the shared version word and
+// writes nothing that other threads read. Store publishes a new value and bumps the version,
+// which makes every thread take a fresh copy, under a mutex, on its next Load. The old snapshot
+// is released once all readers have moved on or exited; a thread that stops reading keeps its
+// copy alive until it exits or the ReadMostlySharedPtr is destroyed.
+//
+// A slot is shared by the pointer and the thread, and whichever of them goes first releases the
+// copy in it. The other forgets the slot the next time it adds one: a thread when it looks for
+// a slot it does not have yet, the pointer on Store and when it gives a thread a new slot. So
+// neither piles up slots the other is done with.
+
+template <typename T, typename Policy = AtomicPolicy>
+class ReadMostlySharedPtr {
+public:
+    ReadMostlySharedPtr() = default;
+
+    explicit ReadMostlySharedPtr(SharedPtr<T, Policy> value) : value_(std::move(value)) {
+    }
+
+    ReadMostlySharedPtr(const ReadMostlySharedPtr&) = delete;
+    ReadMostlySharedPtr& operator=(const ReadMostlySharedPtr&) = delete;
+
+    // No thread may be in Load on this pointer any more.
+    ~ReadMostlySharedPtr() {
+        for (Slot* slot : slots_) {
+            Leave(slot, kPointerGone);
+        }
+    }
+
+    // The reference stays valid until this thread calls Load on this pointer again; copy it to
+    // keep the snapshot for longer.
+    const SharedPtr<T, Policy>& Load() const {
+        Slot* slot = LocalSlot();
+        uint64_t version = version_.load(std::memory_order_acquire);
+        if (slot->version != version) {
+            std::lock_guard lock(mutex_);
+            slot->value = value_;
+            slot->version = version_.load(std::memory_order_relaxed);
+        }
+        return slot->value;
+    }
+
+    void Store(SharedPtr<T, Policy> desired) {
+        std::lock_guard lock(mutex_);
+        value_.Swap(desired);
+        version_.fetch_add(1, std::memory_order_release);
+        PruneSlots();
+    }
+
+    // Slots the calling thread keeps over all pointers of this type, dead ones not yet dropped
+    // included.
+    static size_t NumLocalSlots() {
+        return Local().entries.size();
+    }
+
+private:
+    struct alignas(kCacheLineSize) Slot {
+        uint64_t version = 0;
+        SharedPtr<T, Policy> value;
+        std::atomic<int> gone = 0;  // kPointerGone | kThreadGone.
+        std::atomic<int> refs = 2;  // The pointer and the thread.
+    };
+
+    static constexpr int kPointerGone = 1;
+    static constexpr int kThreadGone = 2;
+
+    // The first of the two to leave releases the copy, so they never both touch it.
+    static void Leave(Slot* slot, int who) {
+        if (slot->gone.fetch_or(who, std::memory_order_acq_rel) == 0) {
+            slot->value.Reset();
+        }
+        if (slot->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            delete slot;
+        }
+    }
+
+    // Drops the slots of exited threads. Called under mutex_.
+    void PruneSlots() const {
+        auto dead = std::remove_if(slots_.begin(), slots_.end(), [](Slot* slot) {
+            if (slot->gone.load(std::memory_order_relaxed) & kThreadGone) {
+                Leave(slot, kPointerGone);
+                return true;
+            }
+            return false;
+        });
+        slots_.erase(dead, slots_.end());
+    }
+
+    // The slots of one thread, most recently used first.
+    struct LocalSlots {
+        ~LocalSlots() {
+            for (auto& [id, slot] : entries) {
+                Leave(slot, kThreadGone);
+            }
+        }
+
+        std::vector<std::pair<uint64_t, Slot*>> entries;
+    };
+
+    // Slots are looked up by an id that is never reused, so a thread never finds a slot of a
+    // destroyed pointer that happened to live at the same address.
+    static uint64_t NextId() {
+        static std::atomic<uint64_t> next = 1;
+        return next.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    static LocalSlots& Local() {
+        thread_local LocalSlots local;
+        return local;
+    }
+
+    Slot* LocalSlot() const {
+        auto& entries = Local().entries;
+        for (size_t i = 0; i < entries.size(); ++i) {
+            if (entries[i].first == id_) {
+                if (i != 0) {
+                    std::swap(entries[i], entries[0]);
+                }
+                return entries[0].second;
+            }
+        }
+        // A miss: drop the slots of destroyed pointers before adding one.
+        auto dead = std::remove_if(entries.begin(), entries.end(), [](const auto& entry) {
+            if (entry.second->gone.load(std::memory_order_relaxed) & kPointerGone) {
+                Leave(entry.second, kThreadGone);
+                return true;
+            }
+            return false;
+        });
+        entries.erase(dead, entries.end());
+        auto slot = new Slot;
+        {
+            std::lock_guard lock(mutex_);
+            PruneSlots();
+            slots_.push_back(slot);
+        }
+        entries.emplace_back(id_, slot);
+        std::swap(entries.back(), entries.front());
+        return slot;
+    }
+
+    const uint64_t id_ = NextId();
+    alignas(kCacheLineSize) std::atomic<uint64_t> version_ = 1;
+    mutable std::mutex mutex_;
+    SharedPtr<T, Policy> value_;
+    mutable std::vector<Slot*> slots_;
+};
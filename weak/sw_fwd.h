@@ -4,8 +4,22 @@
 
 class BadWeakPtr : public std::exception {};
 
-template <typename T>
+class SingleThreadPolicy;
+
+template <typename T, typename Policy = SingleThreadPolicy>
 class SharedPtr;
 
-template <typename T>
+template <typename T, typename Policy = SingleThreadPolicy>
 class WeakPtr;
+
+template <typename T, typename Policy = SingleThreadPolicy, typename... Args>
+SharedPtr<T, Policy> MakeShared(Args&&... args);
+
+template <typename T, typename Policy = SingleThreadPolicy, typename... Args>
+SharedPtr<T, Policy> MakeSharedForOverwrite(Args... size);
+
+template <typename T, typename Policy = SingleThreadPolicy, typename... Args>
+SharedPtr<T, Policy> MakeSharedIsolated(Args&&... args);
+
+template <typename T, typename Policy = SingleThreadPolicy, typename Alloc, typename... Args>
+SharedPtr<T, Policy> AllocateShared(const Alloc& alloc, Args&&... args);
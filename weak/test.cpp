@@ -5,6 +5,8 @@
 
 #include <catch.hpp>
 
+#include <map>
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
 TEST_CASE("Empty weak") {
@@ -163,3 +165,164 @@ TEST_CASE("Lifetimes") {
         delete wp;
     }
 }
+
+TEST_CASE("Packed counters") {
+    WeakPtr<MyInt, PackedPolicy> wp;
+    {
+        SharedPtr<MyInt, PackedPolicy> sp = MakeShared<MyInt, PackedPolicy>(1);
+        wp = sp;
+        WeakPtr<MyInt, PackedPolicy> wp2 = wp;
+        REQUIRE(wp.UseCount() == 1);
+        REQUIRE(wp2.Lock().Get() == sp.Get());
+        REQUIRE(!wp.Expired());
+    }
+    REQUIRE(MyInt::AliveCount() == 0);
+    REQUIRE(wp.Expired());
+    REQUIRE(wp.Lock().Get() == nullptr);
+}
+
+TEST_CASE("Arrays") {
+    WeakPtr<MyInt[]> wp;
+    {
+        auto sp = MakeShared<MyInt[]>(3);
+        wp = sp;
+        REQUIRE(MyInt::AliveCount() == 3);
+        REQUIRE(&wp.Lock()[2] == sp.Get() + 2);
+    }
+    REQUIRE(MyInt::AliveCount() == 0);
+    REQUIRE(wp.Expired());
+}
+
+TEST_CASE("Moves do not count") {
+    static_assert(std::is_nothrow_move_constructible_v<WeakPtr<int>>);
+    static_assert(std::is_nothrow_move_assignable_v<WeakPtr<int>>);
+    static_assert(kIsTriviallyRelocatable<WeakPtr<int>>);
+
+    auto sp = MakeShared<int>(1);
+    WeakPtr<int> a = sp;
+    WeakPtr<int> b = std::move(a);
+    REQUIRE(a.Expired());
+    a = std::move(b);
+    a = std::move(a);
+    REQUIRE(a.Lock().Get() == sp.Get());
+}
+
+TEST_CASE("LockOrReset") {
+    auto sp = MakeShared<MyInt>(5);
+    WeakPtr<MyInt> wp = sp;
+    REQUIRE(*wp.LockOrReset() == 5);
+    REQUIRE(sp.UseCount() == 1);
+
+    sp.Reset();
+    REQUIRE(wp.LockOrReset().Get() == nullptr);
+    REQUIRE(wp.UseCount() == 0);
+    REQUIRE(wp.Expired());
+    REQUIRE(wp.LockOrReset().Get() == nullptr);
+    REQUIRE_THROWS_AS(SharedPtr<MyInt>(wp), BadWeakPtr);
+}
+
+using ObservedPtr = SharedPtr<int, ObservablePolicy<SingleThreadPolicy>>;
+using ObservedWeakPtr = WeakPtr<int, ObservablePolicy<SingleThreadPolicy>>;
+
+// A weak index that drops entries as soon as their values die.
+struct IndexEntry : ExpiryHook {
+    IndexEntry(std::map<int, IndexEntry>* index, int key)
+        : ExpiryHook(&Expire), index(index), key(key) {
+    }
+
+    static void Expire(ExpiryHook* hook) {
+        auto entry = static_cast<IndexEntry*>(hook);
+        entry->index->erase(entry->key);
+    }
+
+    std::map<int, IndexEntry>* index;
+    int key;
+};
+
+struct CountingHook : ExpiryHook {
+    CountingHook() : ExpiryHook(&Count) {
+    }
+
+    static void Count(ExpiryHook* hook) {
+        ++static_cast<CountingHook*>(hook)->fired;
+    }
+
+    int fired = 0;
+};
+
+TEST_CASE("Expiry hooks") {
+    SECTION("Eager unlinking") {
+        std::vector<ObservedPtr> values;
+        std::map<int, IndexEntry> index;
+        for (int i = 0; i < 3; ++i) {
+            values.push_back(MakeShared<int, ObservablePolicy<SingleThreadPolicy>>(i));
+            auto& entry = index.try_emplace(i, &index, i).first->second;
+            REQUIRE(ObservedWeakPtr(values.back()).OnExpire(&entry));
+        }
+        values[1].Reset();
+        REQUIRE(index.size() == 2);
+        REQUIRE(index.count(1) == 0);
+        index.clear();  // Unlinks the rest.
+        values.clear();
+    }
+
+    SECTION("Already expired") {
+        ObservedWeakPtr weak = MakeShared<int, ObservablePolicy<SingleThreadPolicy>>(1);
+        CountingHook hook;
+        REQUIRE(!weak.OnExpire(&hook));
+        REQUIRE(!hook.IsLinked());
+        REQUIRE(!ObservedPtr().OnExpire(&hook));
+    }
+
+    SECTION("Unlinked hooks do not fire") {
+        auto sp = MakeShared<int, ObservablePolicy<SingleThreadPolicy>>(1);
+        CountingHook hook;
+        REQUIRE(sp.OnExpire(&hook));
+        hook.Unlink();
+        sp.Reset();
+        REQUIRE(hook.fired == 0);
+    }
+
+    SECTION("Hooks keep the block") {
+        CountingHook hook;
+        {
+            auto sp = MakeShared<int, ObservablePolicy<SingleThreadPolicy>>(1);
+            REQUIRE(sp.OnExpire(&hook));
+        }
+        REQUIRE(hook.fired == 1);
+        REQUIRE(hook.IsLinked());  // Until the hook lets go of the block.
+    }
+
+    SECTION("Relinking") {
+        auto a = MakeShared<int, ObservablePolicy<SingleThreadPolicy>>(1);
+        auto b = MakeShared<int, ObservablePolicy<SingleThreadPolicy>>(2);
+        CountingHook hook;
+        REQUIRE(a.OnExpire(&hook));
+        REQUIRE(b.OnExpire(&hook));
+        a.Reset();
+        REQUIRE(hook.fired == 0);
+        b.Reset();
+        REQUIRE(hook.fired == 1);
+    }
+
+    SECTION("Callbacks unlink other hooks") {
+        struct Unlinker : ExpiryHook {
+            Unlinker() : ExpiryHook(&UnlinkOther) {
+            }
+
+            static void UnlinkOther(ExpiryHook* hook) {
+                static_cast<Unlinker*>(hook)->other->Unlink();
+            }
+
+            ExpiryHook* other = nullptr;
+        };
+        CountingHook second;
+        Unlinker first;
+        first.other = &second;
+        auto sp = MakeShared<int, ObservablePolicy<SingleThreadPolicy>>(1);
+        REQUIRE(sp.OnExpire(&second));
+        REQUIRE(sp.OnExpire(&first));  // Linked last, fires first.
+        sp.Reset();
+        REQUIRE(second.fired == 0);
+    }
+}
@@ -0,0 +1,171 @@
+#include "shared.h"
+#include "weak.h"
+#include "atomic.h"
+
+#include <catch.hpp>
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+struct Tracked {
+    static inline std::atomic<int> alive = 0;
+
+    explicit Tracked(int value) : value(value) {
+        ++alive;
+    }
+
+    ~Tracked() {
+        --alive;
+    }
+
+    int value;
+};
+
+constexpr int kNumThreads = 8;
+constexpr int kNumIters = 20000;
+
+}  // namespace
+
+TEST_CASE("AtomicSharedPtr basics") {
+    AtomicSharedPtr<std::string> slot;
+    REQUIRE(slot.Load().Get() == nullptr);
+
+    auto first = MakeShared<std::string, AtomicPolicy>("first");
+    slot.Store(first);
+    REQUIRE(first.UseCount() == 2);
+    REQUIRE(*slot.Load() == "first");
+    REQUIRE(first.UseCount() == 2);
+
+    auto old = slot.Exchange(MakeShared<std::string, AtomicPolicy>("second"));
+    REQUIRE(old.Get() == first.Get());
+    REQUIRE(*slot.Load() == "second");
+
+    slot.Store(SharedPtr<std::string, AtomicPolicy>());
+    REQUIRE(slot.Load().Get() == nullptr);
+    old.Reset();
+    REQUIRE(first.UseCount() == 1);
+}
+
+TEST_CASE("AtomicSharedPtr CompareExchange") {
+    auto a = MakeShared<int, AtomicPolicy>(1);
+    auto b = MakeShared<int, AtomicPolicy>(2);
+    AtomicSharedPtr<int> slot(a);
+
+    SharedPtr<int, AtomicPolicy> expected = b;
+    REQUIRE(!slot.CompareExchange(expected, b));
+    REQUIRE(expected.Get() == a.Get());
+
+    REQUIRE(slot.CompareExchange(expected, b));
+    REQUIRE(slot.Load().Get() == b.Get());
+    REQUIRE(a.UseCount() == 2);
+    expected.Reset();
+    REQUIRE(a.UseCount() == 1);
+
+    SharedPtr<int, AtomicPolicy> empty;
+    REQUIRE(!slot.CompareExchange(empty, a));
+    REQUIRE(empty.Get() == b.Get());
+}
+
+TEST_CASE("AtomicWeakPtr") {
+    auto sp = MakeShared<std::string, AtomicPolicy>("weak");
+    AtomicWeakPtr<std::string> slot;
+    REQUIRE(slot.Load().Expired());
+
+    slot.Store(sp);
+    REQUIRE(*slot.Load().Lock() == "weak");
+    REQUIRE(sp.UseCount() == 1);
+
+    WeakPtr<std::string, AtomicPolicy> expected = slot.Load();
+    REQUIRE(slot.CompareExchange(expected, WeakPtr<std::string, AtomicPolicy>()));
+    REQUIRE(slot.Load().Expired());
+
+    slot.Store(sp);
+    sp.Reset();
+    REQUIRE(slot.Load().Expired());
+}
+
+TEST_CASE("AtomicSharedPtr under contention") {
+    SECTION("Readers and a writer") {
+        {
+            AtomicSharedPtr<Tracked> slot(MakeShared<Tracked, AtomicPolicy>(0));
+            std::atomic<bool> done = false;
+            std::atomic<int> broken = 0;
+            std::vector<std::thread> readers;
+            for (int i = 0; i < kNumThreads; ++i) {
+                readers.emplace_back([&] {
+                    int last = 0;
+                    while (!done) {
+                        auto sp = slot.Load();
+                        if (sp->value < last) {
+                            ++broken;
+                        }
+                        last = sp->value;
+                    }
+                });
+            }
+            for (int i = 1; i <= kNumIters; ++i) {
+                slot.Store(MakeShared<Tracked, AtomicPolicy>(i));
+            }
+            done = true;
+            for (auto& thread : readers) {
+                thread.join();
+            }
+            REQUIRE(broken == 0);
+            REQUIRE(slot.Load()->value == kNumIters);
+        }
+        REQUIRE(Tracked::alive == 0);
+    }
+
+    SECTION("CompareExchange increments") {
+        {
+            AtomicSharedPtr<Tracked> slot(MakeShared<Tracked, AtomicPolicy>(0));
+            std::vector<std::thread> threads;
+            for (int i = 0; i < kNumThreads; ++i) {
+                threads.emplace_back([&slot] {
+                    for (int j = 0; j < kNumIters / kNumThreads; ++j) {
+                        auto expected = slot.Load();
+                        while (!slot.CompareExchange(
+                            expected, MakeShared<Tracked, AtomicPolicy>(expected->value + 1))) {
+                        }
+                    }
+                });
+            }
+            for (auto& thread : threads) {
+                thread.join();
+            }
+            REQUIRE(slot.Load()->value == kNumIters);
+        }
+        REQUIRE(Tracked::alive == 0);
+    }
+
+    SECTION("Exchange hands every value out once") {
+        {
+            AtomicSharedPtr<Tracked> slot;
+            std::atomic<long long> sum = 0;
+            std::vector<std::thread> threads;
+            for (int i = 0; i < kNumThreads; ++i) {
+                threads.emplace_back([&slot, &sum] {
+                    for (int j = 1; j <= kNumIters / kNumThreads; ++j) {
+                        auto old = slot.Exchange(MakeShared<Tracked, AtomicPolicy>(j));
+                        if (old.Get() != nullptr) {
+                            sum += old->value;
+                        }
+                    }
+                });
+            }
+            for (auto& thread : threads) {
+                thread.join();
+            }
+            sum += slot.Exchange(SharedPtr<Tracked, AtomicPolicy>())->value;
+            constexpr long long kPerThread = kNumIters / kNumThreads;
+            REQUIRE(sum == kNumThreads * kPerThread * (kPerThread + 1) / 2);
+        }
+        REQUIRE(Tracked::alive == 0);
+    }
+}
@@ -0,0 +1,111 @@
+#include "shared.h"
+#include "weak.h"
+#include "intern.h"
+
+#include <catch.hpp>
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+struct TagSet {
+    std::vector<std::string> tags;
+
+    bool operator==(const TagSet& other) const {
+        return tags == other.tags;
+    }
+};
+
+// Everything collides, so lookups have to compare values.
+struct CollidingHash {
+    size_t operator()(const TagSet&) const {
+        return 7;
+    }
+};
+
+}  // namespace
+
+TEST_CASE("InternPool shares equal values") {
+    InternPool<std::string> pool;
+    auto a = pool.Intern("schema");
+    auto b = pool.Intern(std::string("sche") + "ma");
+    auto c = pool.Intern("other");
+    REQUIRE(a.Get() == b.Get());
+    REQUIRE(a.Get() != c.Get());
+    REQUIRE(*b == "schema");
+    REQUIRE(a.UseCount() == 2);
+    REQUIRE(pool.Size() == 2);
+
+    c.Reset();
+    REQUIRE(pool.Size() == 1);  // Dropped eagerly, no sweep needed.
+    a.Reset();
+    REQUIRE(pool.Size() == 1);
+    b.Reset();
+    REQUIRE(pool.Size() == 0);
+
+    auto again = pool.Intern("schema");
+    REQUIRE(*again == "schema");
+    REQUIRE(pool.Size() == 1);
+}
+
+TEST_CASE("InternPool with colliding hashes") {
+    InternPool<TagSet, ObservablePolicy<SingleThreadPolicy>, CollidingHash> pool;
+    std::vector<SharedPtr<const TagSet, ObservablePolicy<SingleThreadPolicy>>> sets;
+    for (int i = 0; i < 10; ++i) {
+        sets.push_back(pool.Intern(TagSet{{"tag", std::to_string(i)}}));
+    }
+    REQUIRE(pool.Size() == 10);
+    for (int i = 0; i < 10; ++i) {
+        REQUIRE(pool.Intern(TagSet{{"tag", std::to_string(i)}}).Get() == sets[i].Get());
+    }
+    sets.erase(sets.begin() + 3);
+    REQUIRE(pool.Size() == 9);
+    REQUIRE(pool.Intern(TagSet{{"tag", "4"}}).Get() == sets[3].Get());
+}
+
+TEST_CASE("Values outlive the InternPool") {
+    SharedPtr<const std::string, ObservablePolicy<AtomicPolicy>> survivor;
+    {
+        InternPool<std::string> pool;
+        survivor = pool.Intern("kept");
+        pool.Intern("dropped");
+    }
+    REQUIRE(*survivor == "kept");
+}
+
+TEST_CASE("InternPool from many threads") {
+    constexpr int kNumThreads = 8;
+    constexpr int kNumValues = 100;
+    constexpr int kNumRounds = 20000;
+
+    InternPool<int> pool;
+    std::vector<SharedPtr<const int, ObservablePolicy<AtomicPolicy>>> pinned;
+    for (int i = 0; i < kNumValues; i += 2) {
+        pinned.push_back(pool.Intern(i));
+    }
+
+    std::atomic<int> mismatches = 0;
+    std::vector<std::thread> threads;
+    for (int t = 0; t < kNumThreads; ++t) {
+        threads.emplace_back([&, t] {
+            for (int i = 0; i < kNumRounds; ++i) {
+                int value = (i * 7 + t) % kNumValues;
+                auto interned = pool.Intern(value);
+                if (*interned != value ||
+                    (value % 2 == 0 && interned.Get() != pinned[value / 2].Get())) {
+                    ++mismatches;
+                }
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    REQUIRE(mismatches == 0);
+    REQUIRE(pool.Size() == pinned.size());
+}
@@ -0,0 +1,74 @@
+#include "shared.h"
+#include "weak.h"
+
+#include <catch.hpp>
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+struct Guarded {
+    static inline std::atomic<int> destroyed = 0;
+
+    ~Guarded() {
+        value.store(-1, std::memory_order_relaxed);
+        ++destroyed;
+    }
+
+    std::atomic<int> value = 42;
+};
+
+constexpr int kNumReaders = 8;
+constexpr int kNumRounds = 2000;
+constexpr int kLocksPerReader = 256;
+
+}  // namespace
+
+// Readers keep upgrading their weak pointers while the owner drops its strong reference, so the
+// last release may come from any of them. Every upgrade that succeeds must see a live object,
+// and every object dies exactly once. A reader stops after kLocksPerReader upgrades: readers
+// whose references overlap could otherwise keep the object alive forever.
+TEMPLATE_TEST_CASE("Lock races with the last release", "", AtomicPolicy, PackedAtomicPolicy) {
+    Guarded::destroyed = 0;
+    std::atomic<int> failures = 0;
+    for (int round = 0; round < kNumRounds; ++round) {
+        auto owner = MakeShared<Guarded, TestType>();
+        WeakPtr<Guarded, TestType> weak = owner;
+        std::atomic<int> started = 0;
+        std::vector<std::thread> readers;
+        for (int i = 0; i < kNumReaders; ++i) {
+            readers.emplace_back([weak, &started, &failures, i]() mutable {
+                ++started;
+                for (int j = 0; j < kLocksPerReader; ++j) {
+                    auto sp = i % 2 == 0 ? weak.Lock() : weak.LockOrReset();
+                    if (!sp) {
+                        // Once an upgrade fails, the object stays dead.
+                        if (!weak.Expired() || weak.Lock()) {
+                            ++failures;
+                        }
+                        break;
+                    }
+                    if (sp->value.load(std::memory_order_relaxed) != 42) {
+                        ++failures;
+                    }
+                }
+            });
+        }
+        while (started != kNumReaders) {
+            std::this_thread::yield();
+        }
+        owner.Reset();
+        for (auto& thread : readers) {
+            thread.join();
+        }
+        if (!weak.Expired() || weak.Lock() || Guarded::destroyed != round + 1) {
+            ++failures;
+        }
+    }
+    REQUIRE(failures == 0);
+    REQUIRE(Guarded::destroyed == kNumRounds);
+}
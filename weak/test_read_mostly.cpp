@@ -0,0 +1,113 @@
+#include "shared.h"
+#include "read_mostly.h"
+
+#include <catch.hpp>
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+struct Snapshot {
+    static inline std::atomic<int> alive = 0;
+
+    explicit Snapshot(int version) : version(version) {
+        ++alive;
+    }
+
+    ~Snapshot() {
+        --alive;
+    }
+
+    int version;
+};
+
+using SnapshotPtr = SharedPtr<Snapshot, AtomicPolicy>;
+
+}  // namespace
+
+TEST_CASE("ReadMostlySharedPtr basics") {
+    ReadMostlySharedPtr<Snapshot> config;
+    REQUIRE(config.Load().Get() == nullptr);
+
+    config.Store(MakeShared<Snapshot, AtomicPolicy>(1));
+    const SnapshotPtr& first = config.Load();
+    REQUIRE(first->version == 1);
+    REQUIRE(&config.Load() == &first);
+    REQUIRE(first.UseCount() == 2);  // The pointer and this thread's cached copy.
+
+    config.Store(MakeShared<Snapshot, AtomicPolicy>(2));
+    SnapshotPtr kept = config.Load();
+    REQUIRE(kept->version == 2);
+    REQUIRE(Snapshot::alive == 1);
+}
+
+TEST_CASE("ReadMostlySharedPtr releases snapshots") {
+    {
+        ReadMostlySharedPtr<Snapshot> config(MakeShared<Snapshot, AtomicPolicy>(1));
+        std::thread([&config] { REQUIRE(config.Load()->version == 1); }).join();
+        config.Store(MakeShared<Snapshot, AtomicPolicy>(2));
+        REQUIRE(Snapshot::alive == 1);  // The exited thread let go of the first one.
+
+        // Threads come and go while the pointer lives on.
+        for (int version = 3; version <= 100; ++version) {
+            std::thread([&config, version] {
+                REQUIRE(config.Load()->version == version - 1);
+            }).join();
+            config.Store(MakeShared<Snapshot, AtomicPolicy>(version));
+            REQUIRE(Snapshot::alive == 1);
+        }
+    }
+    REQUIRE(Snapshot::alive == 0);
+}
+
+TEST_CASE("ReadMostlySharedPtr forgets destroyed pointers") {
+    ReadMostlySharedPtr<Snapshot> kept(MakeShared<Snapshot, AtomicPolicy>(0));
+    std::thread([&kept] {
+        REQUIRE(kept.Load()->version == 0);
+        for (int i = 1; i <= 1000; ++i) {
+            ReadMostlySharedPtr<Snapshot> config(MakeShared<Snapshot, AtomicPolicy>(i));
+            REQUIRE(config.Load()->version == i);
+            REQUIRE(ReadMostlySharedPtr<Snapshot>::NumLocalSlots() <= 3);
+        }
+        REQUIRE(Snapshot::alive == 1);
+        REQUIRE(kept.Load()->version == 0);
+    }).join();
+    REQUIRE(kept.Load()->version == 0);
+}
+
+TEST_CASE("ReadMostlySharedPtr under writes") {
+    constexpr int kNumReaders = 4;
+    constexpr int kNumVersions = 2000;
+    ReadMostlySharedPtr<Snapshot> config(MakeShared<Snapshot, AtomicPolicy>(0));
+    std::atomic<bool> done = false;
+    std::atomic<int> failures = 0;
+
+    std::vector<std::thread> readers;
+    for (int i = 0; i < kNumReaders; ++i) {
+        readers.emplace_back([&] {
+            int last = 0;
+            while (!done) {
+                int version = config.Load()->version;
+                if (version < last) {
+                    ++failures;
+                }
+                last = version;
+            }
+            if (config.Load()->version != kNumVersions) {
+                ++failures;
+            }
+        });
+    }
+    for (int version = 1; version <= kNumVersions; ++version) {
+        config.Store(MakeShared<Snapshot, AtomicPolicy>(version));
+    }
+    done = true;
+    for (auto& thread : readers) {
+        thread.join();
+    }
+    REQUIRE(failures == 0);
+}
@@ -0,0 +1,114 @@
+#include "thin.h"
+#include "weak.h"
+
+#include <catch.hpp>
+
+#include <string>
+#include <utility>
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+struct Tracked {
+    static inline int alive = 0;
+
+    explicit Tracked(std::string name) : name(std::move(name)) {
+        ++alive;
+    }
+
+    ~Tracked() {
+        --alive;
+    }
+
+    std::string name;
+};
+
+}  // namespace
+
+static_assert(sizeof(ThinSharedPtr<Tracked>) == sizeof(void*));
+static_assert(sizeof(ThinWeakPtr<Tracked>) == sizeof(void*));
+static_assert(sizeof(ThinSharedPtr<Tracked, AtomicPolicy>) == sizeof(void*));
+
+TEST_CASE("ThinSharedPtr basics") {
+    ThinSharedPtr<Tracked> empty;
+    REQUIRE(!empty);
+    REQUIRE(empty.Get() == nullptr);
+    REQUIRE(empty.UseCount() == 0);
+
+    auto ptr = MakeThinShared<Tracked>("a");
+    REQUIRE(ptr);
+    REQUIRE(ptr->name == "a");
+    REQUIRE((*ptr).name == "a");
+    REQUIRE(ptr.UseCount() == 1);
+    REQUIRE(Tracked::alive == 1);
+
+    {
+        auto copy = ptr;
+        REQUIRE(copy == ptr);
+        REQUIRE(ptr.UseCount() == 2);
+
+        auto moved = std::move(copy);
+        REQUIRE(!copy);
+        REQUIRE(moved.Get() == ptr.Get());
+        REQUIRE(ptr.UseCount() == 2);
+    }
+    REQUIRE(ptr.UseCount() == 1);
+
+    auto other = MakeThinShared<Tracked>("b");
+    ptr.Swap(other);
+    REQUIRE(ptr->name == "b");
+    REQUIRE(other->name == "a");
+
+    other = ptr;
+    REQUIRE(Tracked::alive == 1);
+    REQUIRE(ptr.UseCount() == 2);
+
+    ptr.Reset();
+    other.Reset();
+    REQUIRE(Tracked::alive == 0);
+}
+
+TEST_CASE("ThinWeakPtr") {
+    ThinWeakPtr<Tracked> weak;
+    REQUIRE(weak.Expired());
+    REQUIRE(!weak.Lock());
+
+    {
+        auto ptr = MakeThinShared<Tracked>("a");
+        weak = ptr;
+        REQUIRE(!weak.Expired());
+        REQUIRE(weak.UseCount() == 1);
+
+        auto locked = weak.Lock();
+        REQUIRE(locked == ptr);
+        REQUIRE(ptr.UseCount() == 2);
+
+        ThinWeakPtr<Tracked> copy = weak;
+        ThinWeakPtr<Tracked> moved = std::move(copy);
+        REQUIRE(moved.Lock() == ptr);
+    }
+    REQUIRE(Tracked::alive == 0);
+    REQUIRE(weak.Expired());
+    REQUIRE(weak.UseCount() == 0);
+    REQUIRE(!weak.Lock());
+}
+
+TEST_CASE("ThinSharedPtr to SharedPtr") {
+    auto thin = MakeThinShared<Tracked>("a");
+    SharedPtr<Tracked> wide = thin;
+    REQUIRE(wide.Get() == thin.Get());
+    REQUIRE(thin.UseCount() == 2);
+
+    WeakPtr<Tracked> weak = wide;
+    thin.Reset();
+    REQUIRE(!weak.Expired());
+    REQUIRE(weak.Lock()->name == "a");
+
+    wide.Reset();
+    REQUIRE(weak.Expired());
+    REQUIRE(Tracked::alive == 0);
+
+    SharedPtr<Tracked> none = ThinSharedPtr<Tracked>();
+    REQUIRE(!none);
+}
@@ -0,0 +1,162 @@
+#include "shared.h"
+#include "weak.h"
+#include "weak_cache.h"
+
+#include <catch.hpp>
+
+#include <map>
+#include <set>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+struct Pair {
+    int first = 0;
+    int second = 0;
+};
+
+struct Value {
+    static inline int created = 0;
+
+    explicit Value(std::string text) : text(std::move(text)) {
+        ++created;
+    }
+
+    std::string text;
+};
+
+}  // namespace
+
+TEST_CASE("Owner comparisons") {
+    auto pair = MakeShared<Pair>();
+    SharedPtr<int> first(pair, &pair->first);
+    SharedPtr<int> second(pair, &pair->second);
+    WeakPtr<Pair> weak = pair;
+    auto other = MakeShared<Pair>();
+
+    REQUIRE(first.OwnerEqual(second));
+    REQUIRE(first.OwnerEqual(weak));
+    REQUIRE(weak.OwnerEqual(pair));
+    REQUIRE(!pair.OwnerEqual(other));
+    REQUIRE(first.OwnerHash() == weak.OwnerHash());
+    REQUIRE(!first.OwnerBefore(second));
+    REQUIRE(!second.OwnerBefore(first));
+    REQUIRE(pair.OwnerBefore(other) != other.OwnerBefore(pair));
+
+    REQUIRE(SharedPtr<int>().OwnerEqual(WeakPtr<Pair>()));
+    REQUIRE(!SharedPtr<int>().OwnerEqual(weak));
+
+    SECTION("Ordered") {
+        std::set<WeakPtr<Pair>, OwnerLess> set;
+        REQUIRE(set.insert(pair).second);
+        REQUIRE(!set.insert(weak).second);
+        REQUIRE(set.insert(other).second);
+        REQUIRE(set.count(first) == 1);  // Heterogeneous lookup by an aliasing SharedPtr.
+
+        pair.Reset();
+        first.Reset();
+        second.Reset();
+        REQUIRE(weak.Expired());
+        REQUIRE(set.count(weak) == 1);  // Expiring does not move the key.
+        REQUIRE(set.size() == 2);
+    }
+
+    SECTION("Hashed") {
+        std::unordered_set<WeakPtr<Pair>, OwnerHash, OwnerEqual> set;
+        REQUIRE(set.insert(pair).second);
+        REQUIRE(!set.insert(weak).second);
+        REQUIRE(set.insert(other).second);
+
+        pair.Reset();
+        first.Reset();
+        second.Reset();
+        REQUIRE(set.count(weak) == 1);
+        REQUIRE(set.size() == 2);
+    }
+}
+
+TEST_CASE("WeakValueCache") {
+    Value::created = 0;
+    WeakValueCache<int, Value> cache;
+
+    SECTION("Shares live values") {
+        auto a = cache.GetOrCreate(1, "one");
+        auto b = cache.GetOrCreate(1, "ignored");
+        REQUIRE(a == b);
+        REQUIRE(b->text == "one");
+        REQUIRE(Value::created == 1);
+        REQUIRE(a.UseCount() == 2);  // The cache itself holds no strong reference.
+        REQUIRE(cache.Find(1) == a);
+        REQUIRE(!cache.Find(2));
+    }
+
+    SECTION("Recreates dead values") {
+        cache.GetOrCreate(1, "one");
+        REQUIRE(Value::created == 1);
+        REQUIRE(!cache.Find(1));
+        auto again = cache.GetOrCreate(1, "again");
+        REQUIRE(again->text == "again");
+        REQUIRE(Value::created == 2);
+        REQUIRE(cache.Size() == 1);
+    }
+
+    SECTION("Full purge") {
+        auto kept = cache.GetOrCreate(0, "kept");
+        for (int i = 1; i < 100; ++i) {
+            cache.GetOrCreate(i, "dropped");
+        }
+        REQUIRE(cache.Purge() <= 99);
+        REQUIRE(cache.Size() == 1);
+        REQUIRE(cache.Find(0) == kept);
+    }
+
+    SECTION("Incremental purge") {
+        std::vector<SharedPtr<Value>> live;
+        for (int i = 0; i < 100000; ++i) {
+            auto value = cache.GetOrCreate(i, "x");
+            if (i % 100 == 0) {
+                live.push_back(value);
+            }
+        }
+        // Only 1000 values are alive; without purging there would be 100000 slots.
+        REQUIRE(cache.Size() < 20000);
+        for (size_t i = 0; i < live.size(); ++i) {
+            REQUIRE(cache.Find(static_cast<int>(i) * 100) == live[i]);
+        }
+    }
+
+    SECTION("Copies and moves") {
+        auto kept = cache.GetOrCreate(0, "kept");
+        for (int i = 1; i < 100; ++i) {
+            cache.GetOrCreate(i, "dropped");
+        }
+        cache.Purge();
+        for (int i = 1; i < 10; ++i) {
+            cache.GetOrCreate(i, "dropped");  // Leaves the cursor inside the table.
+        }
+        WeakValueCache<int, Value> copy = cache;
+        WeakValueCache<int, Value> assigned;
+        assigned = copy;
+        for (int i = 100; i < 300; ++i) {
+            copy.GetOrCreate(i, "copy");
+            assigned.GetOrCreate(i, "assigned");
+        }
+        REQUIRE(copy.Find(0) == kept);
+        REQUIRE(assigned.Find(0) == kept);
+
+        WeakValueCache<int, Value> moved = std::move(copy);
+        for (int i = 300; i < 500; ++i) {
+            moved.GetOrCreate(i, "moved");
+            copy.GetOrCreate(i, "reused");
+        }
+        REQUIRE(moved.Find(0) == kept);
+        REQUIRE(!copy.Find(0));
+
+        cache.GetOrCreate(1000, "original");
+        REQUIRE(cache.Find(0) == kept);
+    }
+}
@@ -0,0 +1,182 @@
+#pragma once
+
+#include "shared.h"
+
+#include <common/relocatable.h>
+
+#include <cstddef>
+#include <type_traits>
+#include <utility>
+
+// ThinSharedPtr<T> and ThinWeakPtr<T>: SharedPtr / WeakPtr that store nothing but the control
+// block pointer, half the size of the regular ones. They only ever point to an object created
+// by MakeThinShared, whose address follows from the block, so there is no aliasing and no
+// adopting of raw pointers. A ThinSharedPtr converts to a regular SharedPtr when one is needed.
+
+template <typename T, typename Policy = SingleThreadPolicy>
+class ThinWeakPtr;
+
+template <typename T, typename Policy = SingleThreadPolicy>
+class ThinSharedPtr {
+    static_assert(!std::is_array_v<T>, "ThinSharedPtr does not support arrays");
+
+public:
+    ThinSharedPtr() = default;
+    ThinSharedPtr(std::nullptr_t) {
+    }
+
+    ThinSharedPtr(const ThinSharedPtr& other) : block_(other.block_) {
+        SafeIncrement();
+    }
+    ThinSharedPtr(ThinSharedPtr&& other) noexcept : block_(std::exchange(other.block_, nullptr)) {
+    }
+
+    ThinSharedPtr& operator=(const ThinSharedPtr& other) {
+        ThinSharedPtr(other).Swap(*this);
+        return *this;
+    }
+    ThinSharedPtr& operator=(ThinSharedPtr&& other) noexcept {
+        ThinSharedPtr(std::move(other)).Swap(*this);
+        return *this;
+    }
+
+    ~ThinSharedPtr() {
+        if (block_ != nullptr) {
+            block_->StrongDecrement();
+        }
+    }
+
+    void Reset() {
+        ThinSharedPtr().Swap(*this);
+    }
+    void Swap(ThinSharedPtr& other) noexcept {
+        std::swap(block_, other.block_);
+    }
+
+    T* Get() const {
+        return block_ ? reinterpret_cast<T*>(&block_->buffer) : nullptr;
+    }
+    T& operator*() const {
+        return *Get();
+    }
+    T* operator->() const {
+        return Get();
+    }
+    size_t UseCount() const {
+        return block_ ? block_->GetStrongCount() : 0;
+    }
+    explicit operator bool() const {
+        return block_ != nullptr;
+    }
+
+    // A regular SharedPtr sharing ownership with this one.
+    operator SharedPtr<T, Policy>() const {
+        SharedPtr<T, Policy> sp;
+        if (block_ != nullptr) {
+            block_->StrongIncrement();
+            sp.ptr_ = Get();
+            sp.block_ = block_;
+        }
+        return sp;
+    }
+
+private:
+    using Block = CBlockObj<T, Policy>;
+
+    explicit ThinSharedPtr(Block* block) : block_(block) {
+    }
+
+    void SafeIncrement() {
+        if (block_ != nullptr) {
+            block_->StrongIncrement();
+        }
+    }
+
+    template <typename U, typename P, typename... Args>
+    friend ThinSharedPtr<U, P> MakeThinShared(Args&&... args);
+
+    template <typename U, typename P>
+    friend class ThinWeakPtr;
+
+    Block* block_ = nullptr;
+};
+
+template <typename T, typename Policy>
+class ThinWeakPtr {
+public:
+    ThinWeakPtr() = default;
+
+    ThinWeakPtr(const ThinSharedPtr<T, Policy>& other) : block_(other.block_) {
+        SafeIncrement();
+    }
+    ThinWeakPtr(const ThinWeakPtr& other) : block_(other.block_) {
+        SafeIncrement();
+    }
+    ThinWeakPtr(ThinWeakPtr&& other) noexcept : block_(std::exchange(other.block_, nullptr)) {
+    }
+
+    ThinWeakPtr& operator=(const ThinWeakPtr& other) {
+        ThinWeakPtr(other).Swap(*this);
+        return *this;
+    }
+    ThinWeakPtr& operator=(ThinWeakPtr&& other) noexcept {
+        ThinWeakPtr(std::move(other)).Swap(*this);
+        return *this;
+    }
+
+    ~ThinWeakPtr() {
+        if (block_ != nullptr) {
+            block_->WeakDecrement();
+        }
+    }
+
+    void Reset() {
+        ThinWeakPtr().Swap(*this);
+    }
+    void Swap(ThinWeakPtr& other) noexcept {
+        std::swap(block_, other.block_);
+    }
+
+    size_t UseCount() const {
+        return block_ ? block_->GetStrongCount() : 0;
+    }
+    bool Expired() const {
+        return block_ == nullptr || block_->IsObjExpired();
+    }
+
+    ThinSharedPtr<T, Policy> Lock() const {
+        if (block_ != nullptr && block_->TryStrongIncrement()) {
+            return ThinSharedPtr<T, Policy>(block_);
+        }
+        return ThinSharedPtr<T, Policy>();
+    }
+
+private:
+    void SafeIncrement() {
+        if (block_ != nullptr) {
+            block_->WeakIncrement();
+        }
+    }
+
+    typename ThinSharedPtr<T, Policy>::Block* block_ = nullptr;
+};
+
+template <typename T, typename U, typename Policy>
+bool operator==(const ThinSharedPtr<T, Policy>& left, const ThinSharedPtr<U, Policy>& right) {
+    return left.Get() == right.Get();
+}
+
+template <typename T, typename Policy = SingleThreadPolicy, typename... Args>
+ThinSharedPtr<T, Policy> MakeThinShared(Args&&... args) {
+    static_assert(!std::is_convertible_v<T*, ESFTBase*> &&
+                      !std::is_convertible_v<T*, InlineBlockBase*>,
+                  "SharedFromThis needs a regular SharedPtr");
+    return ThinSharedPtr<T, Policy>(
+        new CBlockObj<T, Policy>(std::forward<Args>(args)...));
+}
+
+template <typename T, typename Policy>
+struct IsTriviallyRelocatable<ThinSharedPtr<T, Policy>> : std::true_type {};
+
+template <typename T, typename Policy>
+struct IsTriviallyRelocatable<ThinWeakPtr<T, Policy>> : std::true_type {};
@@ -0,0 +1,119 @@
+#pragma once
+
+#include "shared.h"
+#include "weak.h"
+
+#include <cstddef>
+#include <functional>
+#include <unordered_map>
+#include <utility>
+
+// WeakValueCache<K, V>: a memoization map from keys to WeakPtr<V>. Live values are shared
+// between everybody who asks for the same key, but the cache never keeps a value alive by
+// itself. Dead slots are purged incrementally: every GetOrCreate that adds a slot also checks
+// the next kPurgeSteps slots after a cursor that walks the table round and round, so the
+// table stays within about twice the live entries without a separate cleanup scan. Hits
+// touch nothing but their own slot.
+//
+// Not thread-safe, just like std::unordered_map; wrap it in a mutex to share it.
+
+template <typename K, typename V, typename Policy = SingleThreadPolicy,
+          typename Hash = std::hash<K>, typename KeyEqual = std::equal_to<K>>
+class WeakValueCache {
+public:
+    static constexpr size_t kPurgeSteps = 2;
+
+    WeakValueCache() = default;
+
+    // The cursor points into one table only, so copies and moves start it over.
+    WeakValueCache(const WeakValueCache& other) : map_(other.map_) {
+    }
+    WeakValueCache(WeakValueCache&& other) noexcept : map_(std::move(other.map_)) {
+        other.Clear();
+    }
+
+    WeakValueCache& operator=(const WeakValueCache& other) {
+        map_ = other.map_;
+        cursor_ = map_.end();
+        return *this;
+    }
+    WeakValueCache& operator=(WeakValueCache&& other) noexcept {
+        map_ = std::move(other.map_);
+        cursor_ = map_.end();
+        other.Clear();
+        return *this;
+    }
+
+    // The live value for key, or a new MakeShared<V, Policy>(args...) stored under it.
+    template <typename... Args>
+    SharedPtr<V, Policy> GetOrCreate(const K& key, Args&&... args) {
+        size_t buckets = map_.bucket_count();
+        auto [it, inserted] = map_.try_emplace(key);
+        if (!inserted) {
+            if (SharedPtr<V, Policy> value = it->second.Lock()) {
+                return value;
+            }
+        } else {
+            if (map_.bucket_count() != buckets) {  // Rehashing invalidated the cursor.
+                cursor_ = map_.end();
+            }
+            PurgeSome(it);
+        }
+        // If this throws, the slot stays empty, which counts as dead and is purged later.
+        SharedPtr<V, Policy> value = MakeShared<V, Policy>(std::forward<Args>(args)...);
+        it->second = value;
+        return value;
+    }
+
+    // The live value for key, or an empty pointer.
+    SharedPtr<V, Policy> Find(const K& key) const {
+        auto it = map_.find(key);
+        return it == map_.end() ? SharedPtr<V, Policy>() : it->second.Lock();
+    }
+
+    // Drops every dead slot at once and returns how many there were.
+    size_t Purge() {
+        size_t purged = 0;
+        for (auto it = map_.begin(); it != map_.end();) {
+            if (it->second.Expired()) {
+                it = map_.erase(it);
+                ++purged;
+            } else {
+                ++it;
+            }
+        }
+        cursor_ = map_.end();
+        return purged;
+    }
+
+    // Slots in the table, dead ones that are not purged yet included.
+    size_t Size() const {
+        return map_.size();
+    }
+
+    void Clear() {
+        map_.clear();
+        cursor_ = map_.end();
+    }
+
+private:
+    using Iterator = typename std::unordered_map<K, WeakPtr<V, Policy>, Hash, KeyEqual>::iterator;
+
+    // Checks the next kPurgeSteps slots after the cursor, skipping the one that was just
+    // inserted: it is empty, but about to be filled.
+    void PurgeSome(Iterator fresh) {
+        for (size_t step = 0; step < kPurgeSteps; ++step) {
+            if (cursor_ == map_.end()) {
+                cursor_ = map_.begin();
+            }
+            if (cursor_ != fresh && cursor_->second.Expired()) {
+                cursor_ = map_.erase(cursor_);
+            } else {
+                ++cursor_;
+            }
+        }
+    }
+
+    std::unordered_map<K, WeakPtr<V, Policy>, Hash, KeyEqual> map_;
+    Iterator cursor_ = map_.end();
+};